@@ -0,0 +1,227 @@
+-----------------------------------------------------------------------------
+-- Loopback and unix socket benchmarks
+-- LuaSocket toolkit
+--
+-- usage: lua run.lua [name ...]
+-- Runs the named benchmarks (all by default) against a peer process
+-- started from server.lua, and prints the results as a JSON object.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+local lua = arg[-1] or "lua"
+local dir = arg[0]:match("^(.*)[/\\]") or "."
+
+-----------------------------------------------------------------------------
+-- Helpers
+-----------------------------------------------------------------------------
+local function spawn(kind, mode, count)
+    local peer = assert(io.popen(string.format("%s %s/server.lua %s %s %d",
+        lua, dir, kind, mode, count or 0), "r"))
+    local address = (peer:read("*l") or ""):match("^ready (.*)$")
+    assert(address, "peer process did not start")
+    return peer, address
+end
+
+local function connect(kind, address)
+    local client
+    if kind == "unix" then
+        client = assert(require("socket.unix").stream())
+        assert(client:connect(address))
+    else
+        client = assert(socket.connect("127.0.0.1", tonumber(address)))
+        client:setoption("tcp-nodelay", true)
+    end
+    return client
+end
+
+local function percentile(sorted, p)
+    return sorted[math.max(1, math.ceil(#sorted*p))]
+end
+
+local function encode(value)
+    local t = type(value)
+    if t == "table" then
+        local out = {}
+        if #value > 0 then
+            for i, v in ipairs(value) do out[i] = encode(v) end
+            return "[" .. table.concat(out, ",") .. "]"
+        end
+        local keys = {}
+        for k in pairs(value) do keys[#keys+1] = k end
+        table.sort(keys)
+        for i, k in ipairs(keys) do
+            out[i] = encode(tostring(k)) .. ":" .. encode(value[k])
+        end
+        return "{" .. table.concat(out, ",") .. "}"
+    elseif t == "string" then
+        return '"' .. value:gsub('[%c"\\]', function(c)
+            return string.format("\\u%04x", c:byte())
+        end) .. '"'
+    elseif t == "number" then
+        -- JSON has no inf or nan
+        if value ~= value or value == math.huge or value == -math.huge then
+            return "null"
+        end
+        if value == math.floor(value) and math.abs(value) < 2^53 then
+            return string.format("%.0f", value)
+        end
+        return string.format("%.6g", value)
+    else
+        return tostring(value)
+    end
+end
+
+-----------------------------------------------------------------------------
+-- Benchmarks
+-----------------------------------------------------------------------------
+local bench = {}
+
+-- bulk transfer at several receive sizes
+function bench.throughput()
+    local results = {}
+    local total = 64*1024*1024
+    for _, kind in ipairs{"tcp", "unix"} do
+        for _, size in ipairs{512, 2048, 8192, 65536} do
+            local peer, address = spawn(kind, "source", total)
+            local client = connect(kind, address)
+            local got = 0
+            local t = socket.gettime()
+            while got < total do
+                local data, err, partial = client:receive(size)
+                data = data or partial
+                got = got + #data
+                if err then break end
+            end
+            t = socket.gettime() - t
+            client:close()
+            peer:close()
+            results[#results+1] = {transport = kind, size = size,
+                bytes = got, seconds = t, mbps = got/t/1e6}
+        end
+    end
+    return results
+end
+
+-- request/response round trips
+function bench.latency()
+    local results = {}
+    local count = 10000
+    for _, kind in ipairs{"tcp", "unix"} do
+        local peer, address = spawn(kind, "echo")
+        local client = connect(kind, address)
+        local samples = {}
+        for i = 1, count do
+            local t = socket.gettime()
+            assert(client:send("ping\n"))
+            assert(client:receive())
+            samples[i] = (socket.gettime() - t)*1e6
+        end
+        client:close()
+        peer:close()
+        table.sort(samples)
+        results[#results+1] = {transport = kind, count = count,
+            p50_us = percentile(samples, 0.5),
+            p90_us = percentile(samples, 0.9),
+            p99_us = percentile(samples, 0.99),
+            max_us = samples[#samples]}
+    end
+    return results
+end
+
+-- receive("*l") on 64 byte lines
+function bench.lines()
+    local results = {}
+    local count = 500000
+    for _, kind in ipairs{"tcp", "unix"} do
+        local peer, address = spawn(kind, "lines", count)
+        local client = connect(kind, address)
+        local n = 0
+        local t = socket.gettime()
+        while client:receive() do n = n + 1 end
+        t = socket.gettime() - t
+        client:close()
+        peer:close()
+        results[#results+1] = {transport = kind, lines = n, seconds = t,
+            lps = n/t}
+    end
+    return results
+end
+
+-- 64 byte datagrams, as fast as they can be sent
+function bench.udp()
+    local count = 200000
+    local peer, port = spawn("udp", "sink")
+    local udp = assert(socket.udp())
+    assert(udp:setpeername("127.0.0.1", tonumber(port)))
+    local payload = string.rep("x", 64)
+    local t = socket.gettime()
+    for i = 1, count do udp:send(payload) end
+    t = socket.gettime() - t
+    udp:settimeout(5)
+    local received
+    for i = 1, 10 do
+        udp:send("stop")
+        received = udp:receive()
+        if received then break end
+    end
+    udp:close()
+    peer:close()
+    received = tonumber(received) or 0
+    return {sent = count, received = received, seconds = t,
+        pps = count/t, loss = (count - received)/count}
+end
+
+-- connect and close against an accept loop
+function bench.accept()
+    local results = {}
+    local count = 5000
+    for _, kind in ipairs{"tcp", "unix"} do
+        local peer, address = spawn(kind, "accept", count)
+        local t = socket.gettime()
+        for i = 1, count do connect(kind, address):close() end
+        t = socket.gettime() - t
+        peer:close()
+        results[#results+1] = {transport = kind, count = count,
+            seconds = t, cps = count/t}
+    end
+    return results
+end
+
+-- cost of a select call that finds one ready socket among many
+function bench.select()
+    local results = {}
+    local calls = 2000
+    local server = assert(socket.bind("127.0.0.1", 0))
+    local _, port = server:getsockname()
+    for _, n in ipairs{8, 32, 128, 256} do
+        local clients, recvt = {}, {}
+        for i = 1, n do
+            clients[i] = assert(socket.connect("127.0.0.1", port))
+            recvt[i] = assert(server:accept())
+        end
+        assert(clients[n]:send("x"))
+        assert(#socket.select(recvt, nil, 1) == 1)
+        local t = socket.gettime()
+        for i = 1, calls do socket.select(recvt, nil, 0) end
+        t = socket.gettime() - t
+        for i = 1, n do clients[i]:close() recvt[i]:close() end
+        results[#results+1] = {fds = n, calls = calls,
+            us_per_call = t/calls*1e6}
+    end
+    server:close()
+    return results
+end
+
+-----------------------------------------------------------------------------
+-- Main
+-----------------------------------------------------------------------------
+local order = {"throughput", "latency", "lines", "udp", "accept", "select"}
+local names = #arg > 0 and {...} or order
+local report = {luasocket = socket._VERSION, lua = _VERSION,
+    date = os.date("!%Y-%m-%dT%H:%M:%SZ"), results = {}}
+for _, name in ipairs(names) do
+    local run = bench[name] or error("unknown benchmark " .. name)
+    io.stderr:write("running ", name, "\n")
+    report.results[name] = run()
+end
+print(encode(report))
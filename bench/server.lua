@@ -0,0 +1,115 @@
+-----------------------------------------------------------------------------
+-- Peer process for the benchmarks in run.lua
+-- LuaSocket toolkit
+--
+-- usage: lua server.lua tcp|unix|udp mode count
+-- Prints "ready <port or path>" once listening, serves one run and exits.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+local kind, mode, count = arg[1], arg[2], tonumber(arg[3]) or 0
+
+local function listen()
+    if kind == "unix" then
+        local unix = require("socket.unix")
+        local path = os.tmpname()
+        os.remove(path)
+        local server = assert(unix.stream())
+        assert(server:bind(path))
+        assert(server:listen(128))
+        return server, path
+    else
+        local server = assert(socket.bind("127.0.0.1", 0, 128))
+        local _, port = server:getsockname()
+        return server, port
+    end
+end
+
+local function ready(address)
+    io.stdout:write("ready ", address, "\n")
+    io.stdout:flush()
+end
+
+local function accept(server)
+    local client = assert(server:accept())
+    if kind == "tcp" then client:setoption("tcp-nodelay", true) end
+    return client
+end
+
+-- sends count bytes
+local function source(server)
+    local client = accept(server)
+    local block = string.rep("x", 65536)
+    local left = count
+    while left > 0 do
+        local size = math.min(left, #block)
+        assert(client:send(block, 1, size))
+        left = left - size
+    end
+    client:close()
+end
+
+-- sends count lines of 64 bytes, newline included
+local function lines(server)
+    local client = accept(server)
+    local batch = string.rep(string.rep("x", 63) .. "\n", 1024)
+    local left = count
+    while left > 0 do
+        local n = math.min(left, 1024)
+        assert(client:send(batch, 1, n*64))
+        left = left - n
+    end
+    client:close()
+end
+
+-- echoes lines until the client closes
+local function echo(server)
+    local client = accept(server)
+    while true do
+        local line = client:receive()
+        if not line then break end
+        assert(client:send(line .. "\n"))
+    end
+    client:close()
+end
+
+-- accepts and closes count connections
+local function acceptor(server)
+    for i = 1, count do
+        local client = assert(server:accept())
+        client:close()
+    end
+end
+
+-- counts datagrams until "stop", and replies with the count
+local function udpsink()
+    local udp = assert(socket.udp())
+    assert(udp:setsockname("127.0.0.1", 0))
+    udp:setoption("rcvbuf", 4*1024*1024)
+    udp:settimeout(30)
+    local _, port = udp:getsockname()
+    ready(port)
+    local received = 0
+    while true do
+        local data, ip, from = udp:receivefrom()
+        if not data then break end
+        if data == "stop" then
+            udp:sendto(tostring(received), ip, from)
+            break
+        end
+        received = received + 1
+    end
+    udp:close()
+end
+
+if kind == "udp" then
+    udpsink()
+else
+    local server, address = listen()
+    ready(address)
+    local modes = {source = source, lines = lines, echo = echo,
+        accept = acceptor}
+    assert(modes[mode], "unknown mode")(server)
+    server:close()
+    if kind == "unix" then os.remove(address) end
+end
@@ -2,21 +2,95 @@
 * Input/Output interface for Lua programs
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "compat.h"
 
+#include "auxiliar.h"
+#include "bytes.h"
 #include "buffer.h"
 
+#ifndef LUA_FILEHANDLE
+#define LUA_FILEHANDLE "FILE*"
+#endif
+
+/* size of the block pump moves at a time */
+#define PUMP_SIZE 65536
+
+/* one end of a pump: a stream object, a file, or bytes to send */
+typedef struct t_pumpend_ {
+    p_buffer buf;
+    FILE *file;
+    p_bytes bytes;
+} t_pumpend;
+
+/* kinds of binary fields */
+enum {FIELD_UINT, FIELD_INT, FIELD_FLOAT, FIELD_SKIP, FIELD_STRING,
+    FIELD_LSTRING};
+
 /*=========================================================================*\
 * Internal function prototypes
 \*=========================================================================*/
+static int meth_readu8(lua_State *L);
+static int meth_readu16(lua_State *L);
+static int meth_readu32(lua_State *L);
+static int meth_readu64(lua_State *L);
+static int meth_readi8(lua_State *L);
+static int meth_readi16(lua_State *L);
+static int meth_readi32(lua_State *L);
+static int meth_readi64(lua_State *L);
+static int meth_readf32(lua_State *L);
+static int meth_readf64(lua_State *L);
+static int meth_unpack(lua_State *L);
+static int meth_peek(lua_State *L);
+static int readfield(lua_State *L, int kind, size_t size);
+static p_buffer getbuffer(lua_State *L);
+static p_buffer tobuffer(lua_State *L, int idx);
+static int getendian(lua_State *L, int narg);
+static size_t getsize(lua_State *L, const char **fmt, size_t size);
+static int nativelittle(void);
+static uint64_t getuint(const unsigned char *p, size_t size, int little);
+static void pushfield(lua_State *L, const unsigned char *p, int kind,
+        size_t size, int little);
+static int buffer_fill(p_buffer buf, size_t count);
 static int recvraw(p_buffer buf, size_t wanted, luaL_Buffer *b);
 static int recvline(p_buffer buf, luaL_Buffer *b);
 static int recvall(p_buffer buf, luaL_Buffer *b);
 static int buffer_get(p_buffer buf, const char **data, size_t *count);
 static void buffer_skip(p_buffer buf, size_t count);
 static int sendraw(p_buffer buf, const char *data, size_t count, size_t *sent);
+static int global_pump(lua_State *L);
+static void pump_getend(lua_State *L, int idx, t_pumpend *end);
+static const char *pump_write(t_pumpend *to, const char *data, size_t count,
+        size_t *sent);
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"pump", global_pump},
+    {NULL,   NULL}
+};
+
+/* methods that read from the buffer of stream objects */
+static luaL_Reg readers[] = {
+    {"peek",    meth_peek},
+    {"readf32", meth_readf32},
+    {"readf64", meth_readf64},
+    {"readi8",  meth_readi8},
+    {"readi16", meth_readi16},
+    {"readi32", meth_readi32},
+    {"readi64", meth_readi64},
+    {"readu8",  meth_readu8},
+    {"readu16", meth_readu16},
+    {"readu32", meth_readu32},
+    {"readu64", meth_readu64},
+    {"unpack",  meth_unpack},
+    {NULL,      NULL}
+};
 
 /* min and max macros */
 #ifndef MIN
@@ -33,7 +107,7 @@ static int sendraw(p_buffer buf, const char *data, size_t count, size_t *sent);
 * Initializes module
 \*-------------------------------------------------------------------------*/
 int buffer_open(lua_State *L) {
-    (void) L;
+    luaL_setfuncs(L, func, 0);
     return 0;
 }
 
@@ -48,6 +122,18 @@ void buffer_init(p_buffer buf, p_io io, p_timeout tm) {
     buf->birthday = timeout_gettime();
 }
 
+/*-------------------------------------------------------------------------*\
+* Adds peek and the binary field readers to a class. Its objects must have
+* a __buffer method that returns their buffer
+\*-------------------------------------------------------------------------*/
+void buffer_addreaders(lua_State *L, const char *classname) {
+    luaL_getmetatable(L, classname);
+    lua_pushstring(L, "__index");
+    lua_rawget(L, -2);
+    luaL_setfuncs(L, readers, 0);
+    lua_pop(L, 2);
+}
+
 /*-------------------------------------------------------------------------*\
 * object:getstats() interface
 \*-------------------------------------------------------------------------*/
@@ -70,13 +156,14 @@ int buffer_meth_setstats(lua_State *L, p_buffer buf) {
 }
 
 /*-------------------------------------------------------------------------*\
-* object:send() interface
+* object:send() interface. The data can also be a bytes object, such as a
+* mapped file, which is sent without being copied into a string
 \*-------------------------------------------------------------------------*/
 int buffer_meth_send(lua_State *L, p_buffer buf) {
     int top = lua_gettop(L);
     int err = IO_DONE;
     size_t size = 0, sent = 0;
-    const char *data = luaL_checklstring(L, 2, &size);
+    const char *data = bytes_checklstring(L, 2, &size);
     long start = (long) luaL_optnumber(L, 3, 1);
     long end = (long) luaL_optnumber(L, 4, -1);
     timeout_markstart(buf->tm);
@@ -151,6 +238,69 @@ int buffer_meth_receive(lua_State *L, p_buffer buf) {
     return lua_gettop(L) - top;
 }
 
+/*-------------------------------------------------------------------------*\
+* object:receivesome() interface. Returns whatever one read from the
+* transport layer brought in, so devices that deliver data in bursts
+* are drained with a single call
+\*-------------------------------------------------------------------------*/
+int buffer_meth_receivesome(lua_State *L, p_buffer buf) {
+    int err, top = lua_gettop(L);
+    size_t count, wanted = (size_t) luaL_optnumber(L, 2, BUF_SIZE);
+    const char *data;
+    luaL_argcheck(L, wanted > 0, 2, "invalid size");
+    timeout_markstart(buf->tm);
+    err = buffer_get(buf, &data, &count);
+    if (count > 0) {
+        count = MIN(count, wanted);
+        lua_pushlstring(L, data, count);
+        buffer_skip(buf, count);
+    } else {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+    }
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(buf->tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
+/*-------------------------------------------------------------------------*\
+* object:receiveinto() interface. Works like receivesome, but stores the
+* data in a bytes object. When nothing is buffered and the object has room
+* for a whole buffer, the transport layer reads straight into it
+\*-------------------------------------------------------------------------*/
+int buffer_meth_receiveinto(lua_State *L, p_buffer buf) {
+    int err, top = lua_gettop(L);
+    p_bytes b = bytes_checkwritable(L, 2);
+    size_t count, wanted;
+    size_t offset = bytes_checkrange(L, b, 3, &wanted);
+    luaL_argcheck(L, wanted > 0, 4, "invalid size");
+    timeout_markstart(buf->tm);
+    if (buffer_isempty(buf) && wanted >= BUF_SIZE) {
+        err = buf->io->recv(buf->io->ctx, b->data + offset, wanted, &count,
+            buf->tm);
+        buf->received += count;
+    } else {
+        const char *data;
+        err = buffer_get(buf, &data, &count);
+        count = MIN(count, wanted);
+        memcpy(b->data + offset, data, count);
+        buffer_skip(buf, count);
+    }
+    if (count > 0) {
+        lua_pushnumber(L, (lua_Number) count);
+    } else {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+    }
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(buf->tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
 /*-------------------------------------------------------------------------*\
 * Determines if there is any data in the read buffer
 \*-------------------------------------------------------------------------*/
@@ -158,9 +308,490 @@ int buffer_isempty(p_buffer buf) {
     return buf->first >= buf->last;
 }
 
+/*=========================================================================*\
+* Readers that decode or peek at buffered data in place
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* object:readu8() ... object:readf64() interface. Each reads one field,
+* big-endian unless told otherwise
+\*-------------------------------------------------------------------------*/
+static int meth_readu8(lua_State *L) {
+    return readfield(L, FIELD_UINT, 1);
+}
+
+static int meth_readu16(lua_State *L) {
+    return readfield(L, FIELD_UINT, 2);
+}
+
+static int meth_readu32(lua_State *L) {
+    return readfield(L, FIELD_UINT, 4);
+}
+
+static int meth_readu64(lua_State *L) {
+    return readfield(L, FIELD_UINT, 8);
+}
+
+static int meth_readi8(lua_State *L) {
+    return readfield(L, FIELD_INT, 1);
+}
+
+static int meth_readi16(lua_State *L) {
+    return readfield(L, FIELD_INT, 2);
+}
+
+static int meth_readi32(lua_State *L) {
+    return readfield(L, FIELD_INT, 4);
+}
+
+static int meth_readi64(lua_State *L) {
+    return readfield(L, FIELD_INT, 8);
+}
+
+static int meth_readf32(lua_State *L) {
+    return readfield(L, FIELD_FLOAT, 4);
+}
+
+static int meth_readf64(lua_State *L) {
+    return readfield(L, FIELD_FLOAT, 8);
+}
+
+/*-------------------------------------------------------------------------*\
+* object:unpack() interface. Decodes a record described by a subset of the
+* string.unpack format. Nothing is consumed unless the whole record
+* arrives, so a call that fails with a timeout can simply be repeated
+\*-------------------------------------------------------------------------*/
+static int meth_unpack(lua_State *L) {
+    p_buffer buf = getbuffer(L);
+    const char *fmt = luaL_checkstring(L, 2);
+    const char *err = NULL;
+    int little = 0, top = lua_gettop(L);
+    size_t offset = 0;
+    timeout_markstart(buf->tm);
+    while (*fmt && !err) {
+        int kind = FIELD_UINT, e;
+        size_t size = 0;
+        const unsigned char *p;
+        switch (*fmt++) {
+            case ' ': continue;
+            case '<': little = 1; continue;
+            case '>': little = 0; continue;
+            case '=': little = nativelittle(); continue;
+            case 'b': kind = FIELD_INT; size = 1; break;
+            case 'B': size = 1; break;
+            case 'h': kind = FIELD_INT; size = 2; break;
+            case 'H': size = 2; break;
+            case 'i': kind = FIELD_INT; size = getsize(L, &fmt, 4); break;
+            case 'I': size = getsize(L, &fmt, 4); break;
+            case 'l': case 'j': kind = FIELD_INT; size = 8; break;
+            case 'L': case 'J': size = 8; break;
+            case 'f': kind = FIELD_FLOAT; size = 4; break;
+            case 'd': case 'n': kind = FIELD_FLOAT; size = 8; break;
+            case 'x': kind = FIELD_SKIP; size = 1; break;
+            case 's': kind = FIELD_LSTRING; size = getsize(L, &fmt, 8); break;
+            case 'c':
+                kind = FIELD_STRING;
+                luaL_argcheck(L, *fmt >= '0' && *fmt <= '9', 2,
+                    "missing size for format option 'c'");
+                while (*fmt >= '0' && *fmt <= '9')
+                    size = size*10 + (size_t) (*fmt++ - '0');
+                break;
+            default:
+                luaL_argerror(L, 2, "invalid format option");
+        }
+        /* a string is preceded by its length */
+        if (kind == FIELD_LSTRING) {
+            if (size > BUF_SIZE - offset) {
+                err = "record too large";
+                break;
+            }
+            e = buffer_fill(buf, offset + size);
+            if (e != IO_DONE) {
+                err = buf->io->error(buf->io->ctx, e);
+                break;
+            }
+            p = (const unsigned char *) buf->data + buf->first + offset;
+            offset += size;
+            size = (size_t) getuint(p, size, little);
+            kind = FIELD_STRING;
+        }
+        if (size > BUF_SIZE - offset) {
+            err = "record too large";
+            break;
+        }
+        e = buffer_fill(buf, offset + size);
+        if (e != IO_DONE) {
+            err = buf->io->error(buf->io->ctx, e);
+            break;
+        }
+        p = (const unsigned char *) buf->data + buf->first + offset;
+        offset += size;
+        if (kind == FIELD_SKIP) continue;
+        luaL_checkstack(L, 1, "too many results");
+        if (kind == FIELD_STRING) lua_pushlstring(L, (const char *) p, size);
+        else pushfield(L, p, kind, size, little);
+    }
+    if (err) {
+        lua_settop(L, top);
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+    } else buffer_skip(buf, offset);
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(buf->tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
+/*-------------------------------------------------------------------------*\
+* object:peek() interface. Returns the next n bytes without consuming
+* them, reading until that many are buffered
+\*-------------------------------------------------------------------------*/
+static int meth_peek(lua_State *L) {
+    p_buffer buf = getbuffer(L);
+    lua_Number n = luaL_optnumber(L, 2, 1);
+    size_t wanted = (size_t) n;
+    int err, top = lua_gettop(L);
+    luaL_argcheck(L, n >= 0 && n <= BUF_SIZE, 2, "invalid size");
+    timeout_markstart(buf->tm);
+    err = buffer_fill(buf, wanted);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        /* whatever did arrive, as receive returns a partial result */
+        lua_pushlstring(L, buf->data + buf->first, buf->last - buf->first);
+    } else lua_pushlstring(L, buf->data + buf->first, wanted);
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(buf->tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
+/*=========================================================================*\
+* Global Lua functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Moves data from a stream or file to another, without going through Lua
+* for each chunk.
+*   received, sent = socket.pump(from, to [, filter [, count]])
+* Streams are objects whose metatable has a __buffer method. 'from' can
+* also be a bytes object, such as a mapped file, to send. The optional
+* filter is called for each block, and with nil until it returns nil at
+* the end. Without count, data is moved until 'from' is closed. On
+* failure, returns nil, the error message and which side failed.
+\*-------------------------------------------------------------------------*/
+static int global_pump(lua_State *L) {
+    t_pumpend from, to;
+    int filter = !lua_isnoneornil(L, 3);
+    int limited = !lua_isnoneornil(L, 4);
+    size_t left = limited? (size_t) luaL_checknumber(L, 4): 0;
+    size_t received = 0, sent = 0;
+    const char *err = NULL, *side = NULL;
+    char *block;
+    pump_getend(L, 1, &from);
+    pump_getend(L, 2, &to);
+    lua_settop(L, 4);
+    block = (char *) lua_newuserdata(L, PUMP_SIZE);
+    if (from.buf) timeout_markstart(from.buf->tm);
+    if (to.buf) timeout_markstart(to.buf->tm);
+    while (!limited || left > 0) {
+        size_t count = 0, wanted = limited? MIN(left, PUMP_SIZE): PUMP_SIZE;
+        const char *data = block;
+        int buffered = 0;
+        if (from.bytes) {
+            /* send straight from the bytes object */
+            if (received >= from.bytes->size) {
+                if (limited) {
+                    err = "closed";
+                    side = "source";
+                }
+                break;
+            }
+            data = from.bytes->data + received;
+            count = MIN(from.bytes->size - received, wanted);
+        } else if (from.buf) {
+            p_buffer buf = from.buf;
+            /* whatever was already buffered goes first */
+            if (!buffer_isempty(buf)) {
+                data = buf->data + buf->first;
+                count = MIN(buf->last - buf->first, wanted);
+                buffered = 1;
+            } else {
+                int e = buf->io->recv(buf->io->ctx, block, wanted, &count,
+                    buf->tm);
+                if (count == 0) {
+                    if (e != IO_CLOSED || limited) {
+                        err = buf->io->error(buf->io->ctx, e);
+                        side = "source";
+                    }
+                    break;
+                }
+                buf->received += count;
+            }
+        } else {
+            count = fread(block, 1, wanted, from.file);
+            if (count == 0) {
+                if (ferror(from.file)) {
+                    err = strerror(errno);
+                    side = "source";
+                }
+                break;
+            }
+        }
+        received += count;
+        if (filter) {
+            size_t size = 0;
+            lua_pushvalue(L, 3);
+            lua_pushlstring(L, data, count);
+            if (buffered) buffer_skip(from.buf, count);
+            lua_call(L, 1, 1);
+            data = luaL_optlstring(L, -1, "", &size);
+            err = pump_write(&to, data, size, &sent);
+            lua_pop(L, 1);
+        } else {
+            err = pump_write(&to, data, count, &sent);
+            if (buffered) buffer_skip(from.buf, count);
+        }
+        if (limited) left -= count;
+        if (err) {
+            side = "sink";
+            break;
+        }
+    }
+    /* flush the filter */
+    while (filter && !err) {
+        size_t size = 0;
+        const char *data;
+        lua_pushvalue(L, 3);
+        lua_pushnil(L);
+        lua_call(L, 1, 1);
+        data = lua_tolstring(L, -1, &size);
+        if (!data) break;
+        err = pump_write(&to, data, size, &sent);
+        if (err) side = "sink";
+        lua_pop(L, 1);
+    }
+    if (err) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        lua_pushstring(L, side);
+        return 3;
+    }
+    lua_pushnumber(L, (lua_Number) received);
+    lua_pushnumber(L, (lua_Number) sent);
+    return 2;
+}
+
 /*=========================================================================*\
 * Internal functions
 \*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Returns the buffer handed out by the __buffer metamethod of the object at
+* idx, or NULL if there is none. Only a pointer into the object itself is
+* taken, so that a __buffer written in Lua cannot pass off anything else
+\*-------------------------------------------------------------------------*/
+static p_buffer tobuffer(lua_State *L, int idx) {
+    p_buffer buf = NULL;
+    if (luaL_getmetafield(L, idx, "__buffer")) {
+        const char *obj = (const char *) lua_touserdata(L, idx);
+        size_t len;
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+#if LUA_VERSION_NUM > 501
+        len = lua_rawlen(L, idx);
+#else
+        len = lua_objlen(L, idx);
+#endif
+        if (lua_type(L, idx) == LUA_TUSERDATA && lua_islightuserdata(L, -1)) {
+            const char *p = (const char *) lua_touserdata(L, -1);
+            if (p >= obj && p + sizeof(t_buffer) <= obj + len)
+                buf = (p_buffer) p;
+        }
+        lua_pop(L, 1);
+    }
+    return buf;
+}
+
+/*-------------------------------------------------------------------------*\
+* Finds out what an argument of pump is. Stream objects hand out their
+* buffer through their __buffer metamethod. Anything else must be an
+* open Lua file.
+\*-------------------------------------------------------------------------*/
+static void pump_getend(lua_State *L, int idx, t_pumpend *end) {
+    end->buf = NULL;
+    end->file = NULL;
+    end->bytes = NULL;
+    if (idx == 1 && (end->bytes = (p_bytes) auxiliar_getgroupudata(L,
+            "bytes{any}", idx)) != NULL) return;
+    if ((end->buf = tobuffer(L, idx)) != NULL) return;
+    if (lua_getmetatable(L, idx)) {
+        luaL_getmetatable(L, LUA_FILEHANDLE);
+        if (lua_rawequal(L, -1, -2)) {
+#if LUA_VERSION_NUM > 501
+            luaL_Stream *stream = (luaL_Stream *) lua_touserdata(L, idx);
+            if (stream->closef) end->file = stream->f;
+#else
+            end->file = *(FILE **) lua_touserdata(L, idx);
+#endif
+        }
+        lua_pop(L, 2);
+    }
+    if (!end->buf && !end->file)
+        luaL_argerror(L, idx, "stream or open file expected");
+}
+
+/*-------------------------------------------------------------------------*\
+* Writes a block to the sink side of a pump.
+* Returns NULL on success, or the error message
+\*-------------------------------------------------------------------------*/
+static const char *pump_write(t_pumpend *to, const char *data, size_t count,
+        size_t *sent) {
+    size_t done = 0;
+    if (count == 0) return NULL;
+    if (to->buf) {
+        int err = sendraw(to->buf, data, count, &done);
+        *sent += done;
+        if (err != IO_DONE) return to->buf->io->error(to->buf->io->ctx, err);
+    } else {
+        done = fwrite(data, 1, count, to->file);
+        *sent += done;
+        if (done < count) return strerror(errno);
+    }
+    return NULL;
+}
+/*-------------------------------------------------------------------------*\
+* Reads one binary field of the given kind and size, leaving it buffered
+* if it does not arrive in full
+\*-------------------------------------------------------------------------*/
+static int readfield(lua_State *L, int kind, size_t size) {
+    p_buffer buf = getbuffer(L);
+    int little = getendian(L, 2);
+    int err, top = lua_gettop(L);
+    timeout_markstart(buf->tm);
+    err = buffer_fill(buf, size);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+    } else {
+        pushfield(L, (const unsigned char *) buf->data + buf->first, kind,
+            size, little);
+        buffer_skip(buf, size);
+    }
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(buf->tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the buffer of the stream object at index 1
+\*-------------------------------------------------------------------------*/
+static p_buffer getbuffer(lua_State *L) {
+    p_buffer buf = tobuffer(L, 1);
+    if (!buf) luaL_argerror(L, 1, "stream expected");
+    return buf;
+}
+
+/*-------------------------------------------------------------------------*\
+* Reads an optional byte order: '<' little-endian, '>' big-endian (the
+* default) or '=' native. Returns true for little-endian
+\*-------------------------------------------------------------------------*/
+static int getendian(lua_State *L, int narg) {
+    const char *order = luaL_optstring(L, narg, ">");
+    if (order[0] && !order[1]) {
+        if (order[0] == '<') return 1;
+        if (order[0] == '>') return 0;
+        if (order[0] == '=') return nativelittle();
+    }
+    return luaL_argerror(L, narg, "invalid byte order");
+}
+
+/*-------------------------------------------------------------------------*\
+* Reads the optional size that follows an integer format option
+\*-------------------------------------------------------------------------*/
+static size_t getsize(lua_State *L, const char **fmt, size_t size) {
+    if (**fmt >= '0' && **fmt <= '9') {
+        size = 0;
+        while (**fmt >= '0' && **fmt <= '9' && size <= 8)
+            size = size*10 + (size_t) (*(*fmt)++ - '0');
+    }
+    luaL_argcheck(L, size >= 1 && size <= 8, 2,
+        "integral size out of limits [1,8]");
+    return size;
+}
+
+/*-------------------------------------------------------------------------*\
+* Tells if this machine is little-endian
+\*-------------------------------------------------------------------------*/
+static int nativelittle(void) {
+    const int one = 1;
+    return *(const char *) &one;
+}
+
+/*-------------------------------------------------------------------------*\
+* Assembles an unsigned integer from size bytes
+\*-------------------------------------------------------------------------*/
+static uint64_t getuint(const unsigned char *p, size_t size, int little) {
+    uint64_t value = 0;
+    size_t i;
+    for (i = 0; i < size; i++)
+        value = (value << 8) | p[little? size-1-i: i];
+    return value;
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes a binary field. 64-bit integers are only exact up to 2^53 before
+* Lua 5.3, where they become floats
+\*-------------------------------------------------------------------------*/
+static void pushfield(lua_State *L, const unsigned char *p, int kind,
+        size_t size, int little) {
+    uint64_t value = getuint(p, size, little);
+    if (kind == FIELD_FLOAT) {
+        if (size == 4) {
+            union { uint32_t u; float f; } x;
+            x.u = (uint32_t) value;
+            lua_pushnumber(L, (lua_Number) x.f);
+        } else {
+            union { uint64_t u; double d; } x;
+            x.u = value;
+            lua_pushnumber(L, (lua_Number) x.d);
+        }
+        return;
+    }
+    /* extend the sign of short signed fields */
+    if (kind == FIELD_INT && size < 8 && (value >> (8*size - 1)))
+        value |= ~(uint64_t) 0 << (8*size);
+#if LUA_VERSION_NUM > 502
+    lua_pushinteger(L, (lua_Integer) value);
+#else
+    if (kind == FIELD_INT) lua_pushnumber(L, (lua_Number) (int64_t) value);
+    else lua_pushnumber(L, (lua_Number) value);
+#endif
+}
+
+/*-------------------------------------------------------------------------*\
+* Makes sure at least count bytes are buffered, without consuming any.
+* Count must not exceed BUF_SIZE
+\*-------------------------------------------------------------------------*/
+static int buffer_fill(p_buffer buf, size_t count) {
+    int err = IO_DONE;
+    if (buf->last - buf->first >= count) return IO_DONE;
+    /* move what is buffered to the front to make room */
+    if (buf->first > 0) {
+        memmove(buf->data, buf->data + buf->first, buf->last - buf->first);
+        buf->last -= buf->first;
+        buf->first = 0;
+    }
+    while (buf->last < count && err == IO_DONE) {
+        size_t got = 0;
+        err = buf->io->recv(buf->io->ctx, buf->data + buf->last,
+            BUF_SIZE - buf->last, &got, buf->tm);
+        buf->last += got;
+    }
+    return buf->last >= count? IO_DONE: err;
+}
+
 /*-------------------------------------------------------------------------*\
 * Sends a block of data (unbuffered)
 \*-------------------------------------------------------------------------*/
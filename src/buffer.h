@@ -11,6 +11,8 @@
 *
 * Input is buffered. Output is *not* buffered because there was no simple
 * way of making sure the buffered output data would ever be sent.
+* Buffered input can also be peeked at, or decoded as binary fields,
+* without being copied into Lua strings first.
 *
 * The module is built on top of the I/O abstraction defined in io.h and the
 * timeout management is done with the timeout.h interface.
@@ -36,8 +38,11 @@ typedef t_buffer *p_buffer;
 
 int buffer_open(lua_State *L);
 void buffer_init(p_buffer buf, p_io io, p_timeout tm);
+void buffer_addreaders(lua_State *L, const char *classname);
 int buffer_meth_send(lua_State *L, p_buffer buf);
 int buffer_meth_receive(lua_State *L, p_buffer buf);
+int buffer_meth_receivesome(lua_State *L, p_buffer buf);
+int buffer_meth_receiveinto(lua_State *L, p_buffer buf);
 int buffer_meth_getstats(lua_State *L, p_buffer buf);
 int buffer_meth_setstats(lua_State *L, p_buffer buf);
 int buffer_isempty(p_buffer buf);
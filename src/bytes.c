@@ -0,0 +1,290 @@
+/*=========================================================================*\
+* Byte buffer object
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "compat.h"
+
+#include "auxiliar.h"
+#include "bytes.h"
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int global_mmap(lua_State *L);
+static int global_isbytes(lua_State *L);
+static int meth_len(lua_State *L);
+static int meth_sub(lua_State *L);
+static int meth_view(lua_State *L);
+static int meth_unmap(lua_State *L);
+static size_t bytes_subrange(lua_State *L, p_bytes b, int narg,
+        size_t *count);
+
+/* bytes object methods, shared by buffers and views */
+static luaL_Reg bytes_methods[] = {
+    {"__len",       meth_len},
+    {"__tostring",  auxiliar_tostring},
+    {"len",         meth_len},
+    {"sub",         meth_sub},
+    {"view",        meth_view},
+    {NULL,          NULL}
+};
+
+/* mapped file methods */
+static luaL_Reg mapping_methods[] = {
+    {"__gc",        meth_unmap},
+    {"__len",       meth_len},
+    {"__tostring",  auxiliar_tostring},
+    {"close",       meth_unmap},
+    {"len",         meth_len},
+    {"sub",         meth_sub},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"bytes",   global_create},
+    {"isbytes", global_isbytes},
+    {"mmap",    global_mmap},
+    {NULL,      NULL}
+};
+
+/*=========================================================================*\
+* Exported functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int bytes_open(lua_State *L) {
+    auxiliar_newclass(L, "bytes{buffer}", bytes_methods);
+    auxiliar_newclass(L, "bytes{view}", bytes_methods);
+    auxiliar_newclass(L, "bytes{mapping}", mapping_methods);
+    auxiliar_add2group(L, "bytes{buffer}", "bytes{any}");
+    auxiliar_add2group(L, "bytes{view}", "bytes{any}");
+    auxiliar_add2group(L, "bytes{mapping}", "bytes{any}");
+    auxiliar_add2group(L, "bytes{buffer}", "bytes{viewable}");
+    auxiliar_add2group(L, "bytes{view}", "bytes{viewable}");
+    luaL_setfuncs(L, func, 0);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*\
+* Makes sure argument is a byte buffer and returns it
+\*-------------------------------------------------------------------------*/
+p_bytes bytes_check(lua_State *L, int objidx) {
+    return (p_bytes) auxiliar_checkgroup(L, "bytes{any}", objidx);
+}
+
+/*-------------------------------------------------------------------------*\
+* Makes sure argument is a byte buffer that can be written into. Mapped
+* files are read-only
+\*-------------------------------------------------------------------------*/
+p_bytes bytes_checkwritable(lua_State *L, int objidx) {
+    return (p_bytes) auxiliar_checkgroup(L, "bytes{viewable}", objidx);
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the contents of a string or bytes argument, so that send methods
+* take either one
+\*-------------------------------------------------------------------------*/
+const char *bytes_checklstring(lua_State *L, int narg, size_t *size) {
+    p_bytes b = (p_bytes) auxiliar_getgroupudata(L, "bytes{any}", narg);
+    if (!b) return luaL_checklstring(L, narg, size);
+    *size = b->size;
+    return b->data? b->data: "";
+}
+
+/*-------------------------------------------------------------------------*\
+* Reads the optional 1-based offset at narg and byte count at narg+1.
+* The count defaults to the rest of the buffer. Returns the 0-based offset
+\*-------------------------------------------------------------------------*/
+size_t bytes_checkrange(lua_State *L, p_bytes b, int narg, size_t *count) {
+    lua_Number offset = luaL_optnumber(L, narg, 1);
+    lua_Number n;
+    luaL_argcheck(L, offset >= 1 && offset <= (lua_Number) b->size + 1,
+        narg, "offset out of range");
+    n = luaL_optnumber(L, narg+1, (lua_Number) b->size - offset + 1);
+    luaL_argcheck(L, n >= 0 && offset - 1 + n <= (lua_Number) b->size,
+        narg+1, "count out of range");
+    *count = (size_t) n;
+    return (size_t) offset - 1;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Returns the size of the buffer
+\*-------------------------------------------------------------------------*/
+static int meth_len(lua_State *L) {
+    p_bytes b = bytes_check(L, 1);
+    lua_pushnumber(L, (lua_Number) b->size);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Copies bytes i to j into a string, with the same rules as string.sub
+\*-------------------------------------------------------------------------*/
+static int meth_sub(lua_State *L) {
+    p_bytes b = bytes_check(L, 1);
+    size_t count;
+    size_t offset = bytes_subrange(L, b, 2, &count);
+    if (count == 0) lua_pushliteral(L, "");
+    else lua_pushlstring(L, b->data + offset, count);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns a bytes object for bytes i to j, with the same rules as
+* string.sub, that shares its memory with the original. The view keeps the
+* original from being collected
+\*-------------------------------------------------------------------------*/
+static int meth_view(lua_State *L) {
+    p_bytes b = (p_bytes) auxiliar_checkgroup(L, "bytes{viewable}", 1);
+    size_t count;
+    size_t offset = bytes_subrange(L, b, 2, &count);
+    p_bytes v = (p_bytes) lua_newuserdata(L, sizeof(t_bytes));
+    auxiliar_setclass(L, "bytes{view}", -1);
+    v->size = count;
+    v->data = b->data + offset;
+    lua_newtable(L);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 1);
+#if LUA_VERSION_NUM == 501
+    lua_setfenv(L, -2);
+#else
+    lua_setuservalue(L, -2);
+#endif
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Unmaps a mapped file. The object is left empty
+\*-------------------------------------------------------------------------*/
+static int meth_unmap(lua_State *L) {
+    p_bytes b = (p_bytes) auxiliar_checkclass(L, "bytes{mapping}", 1);
+#ifndef _WIN32
+    if (b->data) munmap(b->data, b->size);
+#endif
+    b->data = NULL;
+    b->size = 0;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*=========================================================================*\
+* Internal functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Reads the optional indices i and j at narg and narg+1, with the same
+* rules as string.sub. Returns the 0-based offset and the byte count
+\*-------------------------------------------------------------------------*/
+static size_t bytes_subrange(lua_State *L, p_bytes b, int narg,
+        size_t *count) {
+    lua_Number size = (lua_Number) b->size;
+    lua_Number i = luaL_optnumber(L, narg, 1);
+    lua_Number j = luaL_optnumber(L, narg+1, -1);
+    /* NaN fails every comparison below and would slip through the clamps */
+    luaL_argcheck(L, i == i, narg, "invalid index");
+    luaL_argcheck(L, j == j, narg+1, "invalid index");
+    if (i < 0) i = size + i + 1;
+    if (j < 0) j = size + j + 1;
+    if (i < 1) i = 1;
+    if (j > size) j = size;
+    if (i > j) {
+        *count = 0;
+        return 0;
+    }
+    *count = (size_t) (j - i + 1);
+    return (size_t) i - 1;
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates a zero-filled byte buffer of the given size
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    lua_Number n = luaL_checknumber(L, 1);
+    size_t size = (size_t) n;
+    p_bytes b;
+    luaL_argcheck(L, n >= 0 && (lua_Number) size == n &&
+        size <= ((size_t) -1) - sizeof(t_bytes), 1, "invalid size");
+    b = (p_bytes) lua_newuserdata(L, sizeof(t_bytes) + size);
+    auxiliar_setclass(L, "bytes{buffer}", -1);
+    b->size = size;
+    b->data = (char *) (b + 1);
+    memset(b->data, 0, size);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Tells if the argument is a bytes object of any kind
+\*-------------------------------------------------------------------------*/
+static int global_isbytes(lua_State *L) {
+    lua_pushboolean(L, auxiliar_getgroupudata(L, "bytes{any}", 1) != NULL);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Maps a regular file into memory, read-only. Another process that
+* truncates the file makes reading past the new end raise SIGBUS
+\*-------------------------------------------------------------------------*/
+static int global_mmap(lua_State *L) {
+#ifdef _WIN32
+    luaL_checkstring(L, 1);
+    lua_pushnil(L);
+    lua_pushstring(L, "mmap not supported");
+    return 2;
+#else
+    const char *path = luaL_checkstring(L, 1);
+    const char *err = NULL;
+    struct stat st;
+    p_bytes b;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    b = (p_bytes) lua_newuserdata(L, sizeof(t_bytes));
+    b->size = 0;
+    b->data = NULL;
+    auxiliar_setclass(L, "bytes{mapping}", -1);
+    if (fstat(fd, &st) < 0) err = strerror(errno);
+    else if (!S_ISREG(st.st_mode)) err = "not a regular file";
+    else if ((lua_Number) st.st_size > (lua_Number) ((size_t) -1))
+        err = "file too large";
+    else if (st.st_size > 0) {
+        void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+            fd, 0);
+        if (data == MAP_FAILED) err = strerror(errno);
+        else {
+            b->data = (char *) data;
+            b->size = (size_t) st.st_size;
+#ifdef MADV_SEQUENTIAL
+            madvise(data, b->size, MADV_SEQUENTIAL);
+#endif
+        }
+    }
+    close(fd);
+    if (err) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    return 1;
+#endif
+}
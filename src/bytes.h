@@ -0,0 +1,31 @@
+#ifndef BYTES_H
+#define BYTES_H
+/*=========================================================================*\
+* Byte buffer object
+* LuaSocket toolkit
+*
+* The bytes.h module provides LuaSocket with a mutable, fixed-size block
+* of memory that receive methods can fill directly. Reusing the same
+* object between calls avoids creating a new Lua string per read.
+* A bytes{view} object points into the block of another one, and keeps it
+* alive, so parts of a buffer can be handed around without copies.
+*
+* A bytes{mapping} object has the same layout, but its block is a private,
+* read-only memory mapping of a file, so send methods can transmit the file
+* without first copying it into Lua strings.
+\*=========================================================================*/
+#include "lua.h"
+
+typedef struct t_bytes_ {
+    size_t size;           /* number of bytes in the block */
+    char *data;            /* first byte of the block */
+} t_bytes;
+typedef t_bytes *p_bytes;
+
+int bytes_open(lua_State *L);
+p_bytes bytes_check(lua_State *L, int objidx);
+p_bytes bytes_checkwritable(lua_State *L, int objidx);
+const char *bytes_checklstring(lua_State *L, int narg, size_t *size);
+size_t bytes_checkrange(lua_State *L, p_bytes b, int narg, size_t *count);
+
+#endif /* BYTES_H */
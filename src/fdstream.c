@@ -0,0 +1,248 @@
+/*=========================================================================*\
+* File descriptor stream
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "compat.h"
+
+#include "auxiliar.h"
+#include "fdstream.h"
+
+#ifndef _WIN32
+#include <stdio.h>
+#include <fcntl.h>
+
+#ifndef LUA_FILEHANDLE
+#define LUA_FILEHANDLE "FILE*"
+#endif
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int meth_send(lua_State *L);
+static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_close(lua_State *L);
+static int meth_settimeout(lua_State *L);
+static int meth_gettimeout(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_setfd(lua_State *L);
+static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
+static int meth_getstats(lua_State *L);
+static int meth_setstats(lua_State *L);
+
+/* fdstream object methods */
+static luaL_Reg fdstream_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
+    {"close",       meth_close},
+    {"dirty",       meth_dirty},
+    {"getfd",       meth_getfd},
+    {"getstats",    meth_getstats},
+    {"gettimeout",  meth_gettimeout},
+    {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
+    {"send",        meth_send},
+    {"setfd",       meth_setfd},
+    {"setstats",    meth_setstats},
+    {"settimeout",  meth_settimeout},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"fdstream", global_create},
+    {NULL, NULL}
+};
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int fdstream_open(lua_State *L) {
+    /* create class */
+    auxiliar_newclass(L, "fdstream{client}", fdstream_methods);
+    auxiliar_add2group(L, "fdstream{client}", "fdstream{any}");
+    buffer_addreaders(L, "fdstream{client}");
+    luaL_setfuncs(L, func, 0);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*\
+* A pty master reads EIO once the other side hangs up, which is as good as
+* end of file for us
+\*-------------------------------------------------------------------------*/
+static int fdstream_read(p_socket ps, char *data, size_t count, size_t *got,
+        p_timeout tm) {
+    int err = socket_read(ps, data, count, got, tm);
+    return err == EIO? IO_CLOSED: err;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Just call buffered IO methods
+\*-------------------------------------------------------------------------*/
+static int meth_send(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkclass(L, "fdstream{client}", 1);
+    return buffer_meth_send(L, &fs->buf);
+}
+
+static int meth_receive(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkclass(L, "fdstream{client}", 1);
+    return buffer_meth_receive(L, &fs->buf);
+}
+
+static int meth_receiveinto(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkclass(L, "fdstream{client}", 1);
+    return buffer_meth_receiveinto(L, &fs->buf);
+}
+
+static int meth_getstats(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkclass(L, "fdstream{client}", 1);
+    return buffer_meth_getstats(L, &fs->buf);
+}
+
+static int meth_setstats(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkclass(L, "fdstream{client}", 1);
+    return buffer_meth_setstats(L, &fs->buf);
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    lua_pushnumber(L, (int) fs->sock);
+    return 1;
+}
+
+/* this is very dangerous, but can be handy for those that are brave enough */
+static int meth_setfd(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    fs->sock = (t_socket) luaL_checknumber(L, 2);
+    return 0;
+}
+
+static int meth_dirty(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    lua_pushboolean(L, !buffer_isempty(&fs->buf));
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_getclassudata(L,
+        "fdstream{client}", 1);
+    if (fs) lua_pushlightuserdata(L, &fs->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Restores the descriptor flags and closes it, unless asked to keep it
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    if (fs->sock != SOCKET_INVALID) {
+        fcntl(fs->sock, F_SETFL, fs->flags);
+        if (!fs->keep) close(fs->sock);
+        fs->sock = SOCKET_INVALID;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Just call tm methods
+\*-------------------------------------------------------------------------*/
+static int meth_settimeout(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    return timeout_meth_settimeout(L, &fs->tm);
+}
+
+static int meth_gettimeout(lua_State *L) {
+    p_fdstream fs = (p_fdstream) auxiliar_checkgroup(L, "fdstream{any}", 1);
+    return timeout_meth_gettimeout(L, &fs->tm);
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Returns the descriptor of the open Lua file at idx, or -1 if there is
+* no such file
+\*-------------------------------------------------------------------------*/
+static t_socket fdstream_getfile(lua_State *L, int idx) {
+    FILE *file = NULL;
+    if (lua_getmetatable(L, idx)) {
+        luaL_getmetatable(L, LUA_FILEHANDLE);
+        if (lua_rawequal(L, -1, -2)) {
+#if LUA_VERSION_NUM > 501
+            luaL_Stream *stream = (luaL_Stream *) lua_touserdata(L, idx);
+            if (stream->closef) file = stream->f;
+#else
+            file = *(FILE **) lua_touserdata(L, idx);
+#endif
+        }
+        lua_pop(L, 2);
+    }
+    return file? fileno(file): SOCKET_INVALID;
+}
+
+/*-------------------------------------------------------------------------*\
+* Wraps a descriptor, or that of an open Lua file, in a stream object.
+* The file keeps owning its descriptor
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    t_socket sock;
+    int keep = lua_toboolean(L, 2);
+    int flags;
+    p_fdstream fs;
+    if (lua_isuserdata(L, 1)) {
+        sock = fdstream_getfile(L, 1);
+        luaL_argcheck(L, sock != SOCKET_INVALID, 1, "open file expected");
+        keep = 1;
+    } else sock = (t_socket) luaL_checknumber(L, 1);
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    /* allocate fdstream object */
+    fs = (p_fdstream) lua_newuserdata(L, sizeof(t_fdstream));
+    memset(fs, 0, sizeof(t_fdstream));
+    /* set its type as client object */
+    auxiliar_setclass(L, "fdstream{client}", -1);
+    /* initialize remaining structure fields */
+    fs->sock = sock;
+    fs->flags = flags;
+    fs->keep = keep;
+    socket_setnonblocking(&fs->sock);
+    io_init(&fs->io, (p_send) socket_write, (p_recv) fdstream_read,
+            (p_error) socket_ioerror, &fs->sock);
+    timeout_init(&fs->tm, -1, -1);
+    buffer_init(&fs->buf, &fs->io, &fs->tm);
+    return 1;
+}
+
+#else
+
+/*-------------------------------------------------------------------------*\
+* Windows descriptors are not sockets, so there is nothing to add
+\*-------------------------------------------------------------------------*/
+int fdstream_open(lua_State *L) {
+    (void) L;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef FDSTREAM_H
+#define FDSTREAM_H
+/*=========================================================================*\
+* File descriptor stream object
+* LuaSocket toolkit
+*
+* The fdstream.h module wraps an arbitrary file descriptor, such as a pipe,
+* a FIFO, a pty or standard input and output, or the descriptor of an open
+* Lua file, in an object with the buffered send/receive methods and
+* timeouts of a tcp{client}. The object
+* has getfd and dirty methods, so it can be waited on by socket.select
+* together with sockets.
+*
+* The descriptor is put in non-blocking mode while it is wrapped. Its
+* original flags are restored on close.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "buffer.h"
+#include "timeout.h"
+#include "socket.h"
+
+typedef struct t_fdstream_ {
+    t_socket sock;
+    int flags;          /* file status flags to restore on close */
+    int keep;           /* close leaves the descriptor open */
+    t_io io;
+    t_buffer buf;
+    t_timeout tm;
+} t_fdstream;
+typedef t_fdstream *p_fdstream;
+
+int fdstream_open(lua_State *L);
+
+#endif /* FDSTREAM_H */
@@ -146,18 +146,22 @@ function metat.__index:send(sendt)
     -- if there is not a pasvt table, then there is a server
     -- and we already sent a PORT command
     if not self.pasvt then self:portconnect() end
-    -- get the sink, source and step for the transfer
-    local step = sendt.step or ltn12.pump.step
-    local readt = { self.tp }
-    local checkstep = function(src, snk)
-        -- check status in control connection while downloading
-        local readyt = socket.select(readt, nil, 0)
-        if readyt[tp] then code = self.try(self.tp:check("2..")) end
-        return step(src, snk)
-    end
     local sink = socket.sink("close-when-done", self.data)
-    -- transfer all data and check error
-    self.try(ltn12.pump.all(sendt.source, sink, checkstep))
+    if sendt.step then
+        -- a custom step is interleaved with checks on the control connection
+        local step = sendt.step
+        local readt = { self.tp }
+        local checkstep = function(src, snk)
+            local readyt = socket.select(readt, nil, 0)
+            if readyt[self.tp] then code = self.try(self.tp:check("2..")) end
+            return step(src, snk)
+        end
+        self.try(ltn12.pump.all(sendt.source, sink, checkstep))
+    else
+        -- the final reply is read after the transfer, so the control
+        -- connection needs no polling and socket.pump can move the data
+        self.try(ltn12.pump.fast(sendt.source, sink))
+    end
     if string.find(code, "1..") then self.try(self.tp:check("2..")) end
     -- done with data connection
     self.data:close()
@@ -183,7 +187,7 @@ function metat.__index:receive(recvt)
     if not self.pasvt then self:portconnect() end
     local source = socket.source("until-closed", self.data)
     local step = recvt.step or ltn12.pump.step
-    self.try(ltn12.pump.all(source, recvt.sink, step))
+    self.try(ltn12.pump.fast(source, recvt.sink, step))
     if string.find(code, "1..") then self.try(self.tp:check("2..")) end
     self.data:close()
     self.data = nil
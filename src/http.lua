@@ -143,7 +143,7 @@ function metat.__index:sendbody(headers, source, step)
     -- if we don't know the size in advance, send chunked and hope for the best
     local mode = "http-chunked"
     if headers["content-length"] then mode = "keep-open" end
-    return self.try(ltn12.pump.all(source, socket.sink(mode, self.c), step))
+    return self.try(ltn12.pump.fast(source, socket.sink(mode, self.c), step))
 end
 
 function metat.__index:receivestatusline()
@@ -169,7 +169,7 @@ function metat.__index:receivebody(headers, sink, step)
     local mode = "default" -- connection close
     if t and t ~= "identity" then mode = "http-chunked"
     elseif base.tonumber(headers["content-length"]) then mode = "by-length" end
-    return self.try(ltn12.pump.all(socket.source(mode, self.c, length),
+    return self.try(ltn12.pump.fast(socket.source(mode, self.c, length),
         sink, step))
 end
 
@@ -9,6 +9,7 @@
 -----------------------------------------------------------------------------
 local string = require("string")
 local table = require("table")
+local math = require("math")
 local unpack = unpack or table.unpack
 local base = _G
 local _M = {}
@@ -25,8 +26,30 @@ _M.pump = pump
 local unpack = unpack or table.unpack
 local select = base.select
 
+-- sources and sinks that pump.fast knows how to take apart
+local native = base.setmetatable({}, { __mode = "k" })
+
+-- the C pump lives in socket.core, which ltn12 does not otherwise need
+local core
+local function getcore()
+    if core == nil then
+        local ok, mod = base.pcall(base.require, "socket.core")
+        core = ok and base.type(mod) == "table" and mod.pump and mod or false
+    end
+    return core
+end
+
+-- chunks can be LuaSocket bytes objects. sinks that need a string, like
+-- files and tables, copy them into one
+local function tostr(chunk)
+    if base.type(chunk) == "userdata" then return chunk:sub() end
+    return chunk
+end
+
 -- 2048 seems to be better in windows...
 _M.BLOCKSIZE = 2048
+-- file sources double their chunks up to this size while the file lasts
+_M.MAXBLOCKSIZE = 65536
 _M._VERSION = "LTN12 1.0.3"
 
 -----------------------------------------------------------------------------
@@ -96,14 +119,46 @@ end
 -- creates a file source
 function source.file(handle, io_err)
     if handle then
-        return function()
-            local chunk = handle:read(_M.BLOCKSIZE)
-            if not chunk then handle:close() end
+        local size = _M.BLOCKSIZE
+        local src = function()
+            local chunk = handle:read(size)
+            if not chunk then handle:close()
+            elseif string.len(chunk) == size then
+                size = math.max(math.min(2*size, _M.MAXBLOCKSIZE),
+                    _M.BLOCKSIZE)
+            end
             return chunk
         end
+        native[src] = { handle = handle }
+        return src
     else return source.error(io_err or "unable to open file") end
 end
 
+-- creates a source that reads a file through a memory mapping, in chunks
+-- of the given size. falls back to a file source where socket.mmap is
+-- not available. pump.fast sends straight from the mapping
+function source.mmap(path, chunk)
+    local map = getcore() and core.mmap and core.mmap(path)
+    if not map then return source.file(base.io.open(path, "rb")) end
+    chunk = chunk or _M.MAXBLOCKSIZE
+    local size, i = map:len(), 1
+    local src = function()
+        if i > size then
+            map:close()
+            return nil
+        end
+        local s = map:sub(i, i + chunk - 1)
+        i = i + chunk
+        return s
+    end
+    native[src] = {
+        handle = map,
+        fresh = function() return i == 1 end,
+        skip = function() i = size + 1 end
+    }
+    return src
+end
+
 -- turns a fancy source into a simple source
 function source.simplify(src)
     base.assert(src)
@@ -119,8 +174,9 @@ end
 function source.string(s)
     if s then
         local i = 1
+        local sub = base.type(s) == "userdata" and s.sub or string.sub
         return function()
-            local chunk = string.sub(s, i, i+_M.BLOCKSIZE-1)
+            local chunk = sub(s, i, i+_M.BLOCKSIZE-1)
             i = i + _M.BLOCKSIZE
             if chunk ~= "" then return chunk
             else return nil end
@@ -150,7 +206,7 @@ function source.chain(src, f, ...)
     local last_in, last_out = "", ""
     local state = "feeding"
     local err
-    return function()
+    local chained = function()
         if not last_out then
             base.error('source is empty!', 2)
         end
@@ -190,6 +246,8 @@ function source.chain(src, f, ...)
             end
         end
     end
+    native[chained] = { source = src, filter = f }
+    return chained
 end
 
 -- creates a source that produces contents of several sources, one after the
@@ -215,7 +273,7 @@ end
 function sink.table(t)
     t = t or {}
     local f = function(chunk, err)
-        if chunk then table.insert(t, chunk) end
+        if chunk then table.insert(t, tostr(chunk)) end
         return 1
     end
     return f, t
@@ -235,12 +293,14 @@ end
 -- creates a file sink
 function sink.file(handle, io_err)
     if handle then
-        return function(chunk, err)
+        local snk = function(chunk, err)
             if not chunk then
                 handle:close()
                 return 1
-            else return handle:write(chunk) end
+            else return handle:write(tostr(chunk)) end
         end
+        native[snk] = { handle = handle }
+        return snk
     else return sink.error(io_err or "unable to open file") end
 end
 
@@ -268,7 +328,7 @@ function sink.chain(f, snk, ...)
         f = filter.chain(unpack(args))
     end
     base.assert(f and snk)
-    return function(chunk, err)
+    local chained = function(chunk, err)
         if chunk ~= "" then
             local filtered = f(chunk)
             local done = chunk and ""
@@ -280,6 +340,8 @@ function sink.chain(f, snk, ...)
             end
         else return 1 end
     end
+    native[chained] = { sink = snk, filter = f }
+    return chained
 end
 
 -----------------------------------------------------------------------------
@@ -306,4 +368,63 @@ function pump.all(src, snk, step)
     end
 end
 
+-- tells if socket.pump can move data in and out of an object by itself
+local function pumpable(h, side)
+    if base.io and base.io.type(h) == "file" then return true end
+    if side == "source" and getcore() and core.isbytes and
+            core.isbytes(h) then
+        return true
+    end
+    local mt = base.getmetatable(h)
+    return base.type(mt) == "table" and mt.__buffer and
+        mt.__buffer(h) ~= nil
+end
+
+-- finds the socket or file behind a source or sink, going through the
+-- filters chained to it. returns nil if there is none
+local function endpoint(x, side)
+    local info = native[x]
+    if info and info.handle then
+        if pumpable(info.handle, side) and
+                (not info.fresh or info.fresh()) then
+            return { handle = info.handle, node = x, skip = info.skip }
+        end
+    elseif info then
+        local e = endpoint(info[side], side)
+        if not e then return nil end
+        if not e.filter then e.filter = info.filter
+        elseif side == "source" then
+            e.filter = filter.chain(e.filter, info.filter)
+        else e.filter = filter.chain(info.filter, e.filter) end
+        return e
+    elseif base.type(x) == "table" and pumpable(x.sock) then
+        return { handle = x.sock, node = x, length = x.length }
+    end
+end
+
+-- pumps all data from a source to a sink. when both ends are sockets or
+-- files, possibly with filters chained to them, the data is moved by
+-- socket.pump in large blocks. otherwise, or if a step function other
+-- than pump.step is given, this is the same as pump.all
+function pump.fast(src, snk, step)
+    base.assert(src and snk)
+    local from = (not step or step == pump.step) and endpoint(src, "source")
+    local to = from and endpoint(snk, "sink")
+    if not (to and getcore()) then return pump.all(src, snk, step) end
+    local f = from.filter
+    if to.filter then f = f and filter.chain(f, to.filter) or to.filter end
+    local received, err, side = core.pump(from.handle, to.handle, f,
+        from.length)
+    if received then
+        if from.length then from.node.length = from.length - received end
+        -- let both ends finish the way they would under pump.all
+        if from.skip then from.skip() end
+        from.node()
+        to.node(nil)
+        return 1
+    end
+    if side == "source" then to.node(nil, err) end
+    return nil, err
+end
+
 return _M
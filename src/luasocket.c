@@ -30,6 +30,9 @@
 #include "inet.h"
 #include "tcp.h"
 #include "udp.h"
+#include "bytes.h"
+#include "fdstream.h"
+#include "memchannel.h"
 #include "select.h"
 
 /*-------------------------------------------------------------------------*\
@@ -50,6 +53,9 @@ static const luaL_Reg mod[] = {
     {"inet", inet_open},
     {"tcp", tcp_open},
     {"udp", udp_open},
+    {"bytes", bytes_open},
+    {"fdstream", fdstream_open},
+    {"memchannel", memchannel_open},
     {"select", select_open},
     {NULL, NULL}
 };
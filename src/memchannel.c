@@ -0,0 +1,356 @@
+/*=========================================================================*\
+* In-process channel
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "compat.h"
+
+#include "auxiliar.h"
+#include "memchannel.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+
+/* bytes written by one side and not yet read by the other */
+typedef struct t_memqueue_ {
+    char *data;
+    size_t first, last, size;
+    int pipe[2];        /* holds one byte while the queue is readable */
+    int rung;
+} t_memqueue;
+
+/* queue i carries the data sent by side i */
+struct t_memshared_ {
+    t_memqueue q[2];
+    size_t limit;
+    int closed[2];
+    int refs;
+};
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int meth_send(lua_State *L);
+static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_receivesome(lua_State *L);
+static int meth_close(lua_State *L);
+static int meth_settimeout(lua_State *L);
+static int meth_gettimeout(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
+static int meth_getstats(lua_State *L);
+static int meth_setstats(lua_State *L);
+
+static int memchannel_send(void *ctx, const char *data, size_t count,
+        size_t *sent, p_timeout tm);
+static int memchannel_recv(void *ctx, char *data, size_t count,
+        size_t *got, p_timeout tm);
+
+/* memchannel object methods */
+static luaL_Reg memchannel_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
+    {"close",       meth_close},
+    {"dirty",       meth_dirty},
+    {"getfd",       meth_getfd},
+    {"getstats",    meth_getstats},
+    {"gettimeout",  meth_gettimeout},
+    {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
+    {"receivesome", meth_receivesome},
+    {"send",        meth_send},
+    {"setstats",    meth_setstats},
+    {"settimeout",  meth_settimeout},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"memchannel", global_create},
+    {NULL, NULL}
+};
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int memchannel_open(lua_State *L) {
+    /* create class */
+    auxiliar_newclass(L, "memchannel{client}", memchannel_methods);
+    auxiliar_add2group(L, "memchannel{client}", "memchannel{any}");
+    buffer_addreaders(L, "memchannel{client}");
+    luaL_setfuncs(L, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Queue primitives
+\*=========================================================================*/
+static void memqueue_ring(t_memqueue *q) {
+    char c = 0;
+    if (!q->rung && write(q->pipe[1], &c, 1) == 1) q->rung = 1;
+}
+
+static void memqueue_clear(t_memqueue *q) {
+    char c;
+    if (q->rung && read(q->pipe[0], &c, 1) == 1) q->rung = 0;
+}
+
+/* makes room for count more bytes at the end of the queue */
+static int memqueue_reserve(t_memqueue *q, size_t count) {
+    if (q->last + count <= q->size) return IO_DONE;
+    if (q->first > 0) {
+        memmove(q->data, q->data + q->first, q->last - q->first);
+        q->last -= q->first;
+        q->first = 0;
+    }
+    if (q->last + count > q->size) {
+        size_t size = q->size? q->size: BUF_SIZE;
+        char *data;
+        while (size < q->last + count) size *= 2;
+        data = (char *) realloc(q->data, size);
+        if (!data) return ENOMEM;
+        q->data = data;
+        q->size = size;
+    }
+    return IO_DONE;
+}
+
+static void memshared_release(t_memshared *sh) {
+    int i;
+    if (--sh->refs > 0) return;
+    for (i = 0; i < 2; i++) {
+        free(sh->q[i].data);
+        if (sh->q[i].pipe[0] >= 0) close(sh->q[i].pipe[0]);
+        if (sh->q[i].pipe[1] >= 0) close(sh->q[i].pipe[1]);
+    }
+    free(sh);
+}
+
+/*-------------------------------------------------------------------------*\
+* I/O driver callbacks. Nobody else can run while we wait, so there is no
+* point in waiting
+\*-------------------------------------------------------------------------*/
+static int memchannel_send(void *ctx, const char *data, size_t count,
+        size_t *sent, p_timeout tm) {
+    p_memchannel ch = (p_memchannel) ctx;
+    t_memshared *sh = ch->shared;
+    t_memqueue *q;
+    size_t space;
+    int err;
+    (void) tm;
+    *sent = 0;
+    if (!sh || sh->closed[!ch->side]) return IO_CLOSED;
+    q = &sh->q[ch->side];
+    space = sh->limit - (q->last - q->first);
+    if (count > space) count = space;
+    if (count == 0) return space? IO_DONE: IO_TIMEOUT;
+    if ((err = memqueue_reserve(q, count)) != IO_DONE) return err;
+    memcpy(q->data + q->last, data, count);
+    q->last += count;
+    memqueue_ring(q);
+    *sent = count;
+    return IO_DONE;
+}
+
+static int memchannel_recv(void *ctx, char *data, size_t count,
+        size_t *got, p_timeout tm) {
+    p_memchannel ch = (p_memchannel) ctx;
+    t_memshared *sh = ch->shared;
+    t_memqueue *q;
+    (void) tm;
+    *got = 0;
+    if (!sh) return IO_CLOSED;
+    q = &sh->q[!ch->side];
+    if (q->last == q->first)
+        return sh->closed[!ch->side]? IO_CLOSED: IO_TIMEOUT;
+    if (count > q->last - q->first) count = q->last - q->first;
+    memcpy(data, q->data + q->first, count);
+    q->first += count;
+    if (q->first == q->last) {
+        q->first = q->last = 0;
+        if (!sh->closed[!ch->side]) memqueue_clear(q);
+    }
+    *got = count;
+    return IO_DONE;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Just call buffered IO methods
+\*-------------------------------------------------------------------------*/
+static int meth_send(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_send(L, &ch->buf);
+}
+
+static int meth_receive(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_receive(L, &ch->buf);
+}
+
+static int meth_receiveinto(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_receiveinto(L, &ch->buf);
+}
+
+static int meth_receivesome(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_receivesome(L, &ch->buf);
+}
+
+static int meth_getstats(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_getstats(L, &ch->buf);
+}
+
+static int meth_setstats(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkclass(L,
+        "memchannel{client}", 1);
+    return buffer_meth_setstats(L, &ch->buf);
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkgroup(L,
+        "memchannel{any}", 1);
+    lua_pushnumber(L, (int) ch->sock);
+    return 1;
+}
+
+static int meth_dirty(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkgroup(L,
+        "memchannel{any}", 1);
+    lua_pushboolean(L, !buffer_isempty(&ch->buf));
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_getclassudata(L,
+        "memchannel{client}", 1);
+    if (ch) lua_pushlightuserdata(L, &ch->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Closes our end. The other end reads what is left and then "closed"
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkgroup(L,
+        "memchannel{any}", 1);
+    t_memshared *sh = ch->shared;
+    if (sh) {
+        sh->closed[ch->side] = 1;
+        memqueue_ring(&sh->q[ch->side]);
+        memshared_release(sh);
+        ch->shared = NULL;
+        ch->sock = SOCKET_INVALID;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Just call tm methods
+\*-------------------------------------------------------------------------*/
+static int meth_settimeout(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkgroup(L,
+        "memchannel{any}", 1);
+    return timeout_meth_settimeout(L, &ch->tm);
+}
+
+static int meth_gettimeout(lua_State *L) {
+    p_memchannel ch = (p_memchannel) auxiliar_checkgroup(L,
+        "memchannel{any}", 1);
+    return timeout_meth_gettimeout(L, &ch->tm);
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+static p_memchannel memchannel_push(lua_State *L, int side) {
+    p_memchannel ch = (p_memchannel) lua_newuserdata(L, sizeof(t_memchannel));
+    memset(ch, 0, sizeof(t_memchannel));
+    ch->sock = SOCKET_INVALID;
+    ch->side = side;
+    auxiliar_setclass(L, "memchannel{client}", -1);
+    io_init(&ch->io, memchannel_send, memchannel_recv,
+            (p_error) socket_ioerror, ch);
+    timeout_init(&ch->tm, -1, -1);
+    buffer_init(&ch->buf, &ch->io, &ch->tm);
+    return ch;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates both ends of a channel. size bounds what each direction holds
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    lua_Number limit = luaL_optnumber(L, 1, MEMCHANNEL_SIZE);
+    p_memchannel a, b;
+    t_memshared *sh;
+    int i, j;
+    luaL_argcheck(L, limit >= 1, 1, "invalid channel size");
+    a = memchannel_push(L, 0);
+    b = memchannel_push(L, 1);
+    sh = (t_memshared *) calloc(1, sizeof(t_memshared));
+    if (!sh) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(ENOMEM));
+        return 2;
+    }
+    sh->limit = (size_t) limit;
+    sh->refs = 2;
+    for (i = 0; i < 2; i++) {
+        t_memqueue *q = &sh->q[i];
+        if (pipe(q->pipe) < 0) {
+            int err = errno;
+            q->pipe[0] = q->pipe[1] = -1;
+            if (i == 0) sh->q[1].pipe[0] = sh->q[1].pipe[1] = -1;
+            sh->refs = 1;
+            memshared_release(sh);
+            lua_pushnil(L);
+            lua_pushstring(L, socket_strerror(err));
+            return 2;
+        }
+        for (j = 0; j < 2; j++) {
+            fcntl(q->pipe[j], F_SETFD, FD_CLOEXEC);
+            socket_setnonblocking(&q->pipe[j]);
+        }
+    }
+    a->shared = b->shared = sh;
+    a->sock = sh->q[1].pipe[0];
+    b->sock = sh->q[0].pipe[0];
+    return 2;
+}
+
+#else
+
+/*-------------------------------------------------------------------------*\
+* Select needs a descriptor per endpoint, so there is nothing to add
+\*-------------------------------------------------------------------------*/
+int memchannel_open(lua_State *L) {
+    (void) L;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MEMCHANNEL_H
+#define MEMCHANNEL_H
+/*=========================================================================*\
+* In-process channel object
+* LuaSocket toolkit
+*
+* The memchannel.h module provides a pair of connected endpoints that move
+* bytes through memory queues instead of the kernel. Each endpoint has the
+* buffered send/receive methods of a tcp{client}, so protocol code can be
+* run against it unchanged, for example to connect two coroutines.
+*
+* Both ends live in the same Lua state, so nothing can arrive while one of
+* them waits. Operations that would block return "timeout" right away,
+* whatever the timeout is. Each queue has a pipe that is kept readable
+* while the queue holds data or its writer is closed, so that select can
+* wait on the endpoints together with sockets.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "buffer.h"
+#include "timeout.h"
+#include "socket.h"
+
+#define MEMCHANNEL_SIZE 65536
+
+typedef struct t_memshared_ t_memshared;
+
+typedef struct t_memchannel_ {
+    t_socket sock;      /* readable end of our queue's pipe */
+    t_memshared *shared;
+    int side;
+    t_io io;
+    t_buffer buf;
+    t_timeout tm;
+} t_memchannel;
+typedef t_memchannel *p_memchannel;
+
+int memchannel_open(lua_State *L);
+
+#endif /* MEMCHANNEL_H */
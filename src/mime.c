@@ -2,12 +2,14 @@
 * MIME support functions
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <stdlib.h>
 #include <string.h>
 
 #include "lua.h"
 #include "lauxlib.h"
 #include "compat.h"
 
+#include "bytes.h"
 #include "mime.h"
 
 /*=========================================================================*\
@@ -17,6 +19,17 @@ typedef unsigned char UC;
 static const char CRLF[] = "\r\n";
 static const char EQCRLF[] = "=\r\n";
 
+/*=========================================================================*\
+* Output of the encoding functions. Bytes go either to a Lua buffer or,
+* when lb is NULL, to a block of memory owned by a chain stage
+\*=========================================================================*/
+typedef struct t_mbuf_ {
+    luaL_Buffer *lb;
+    lua_State *L;
+    char *data;
+    size_t n, size;
+} t_mbuf;
+
 /*=========================================================================*\
 * Internal function prototypes.
 \*=========================================================================*/
@@ -28,24 +41,56 @@ static int mime_global_unqp(lua_State *L);
 static int mime_global_qpwrp(lua_State *L);
 static int mime_global_eol(lua_State *L);
 static int mime_global_dot(lua_State *L);
+static int mime_global_chain(lua_State *L);
+static int chain_meth_call(lua_State *L);
+static int chain_meth_gc(lua_State *L);
+
+static const char *mime_optinput(lua_State *L, int narg, size_t *size);
+static void mbuf_buffinit(lua_State *L, t_mbuf *mb, luaL_Buffer *lb);
+static char *mbuf_reserve(t_mbuf *mb, size_t wanted, size_t *size);
+static void mbuf_addsize(t_mbuf *mb, size_t n);
+static void mbuf_addchar(t_mbuf *mb, char c);
+static void mbuf_addlstring(t_mbuf *mb, const char *s, size_t len);
+static void mbuf_addstring(t_mbuf *mb, const char *s);
 
-static size_t dot(int c, size_t state, luaL_Buffer *buffer);
+static size_t dot(int c, size_t state, t_mbuf *buffer);
+static size_t dotblock(const char *input, size_t size, size_t state,
+        t_mbuf *buffer);
+static int eolprocess(int c, int last, const char *marker,
+        t_mbuf *buffer);
+static int eolblock(const char *input, size_t size, int ctx,
+        const char *marker, t_mbuf *buffer);
+static int wrpblock(const UC *input, size_t size, int left, int length,
+        t_mbuf *buffer);
+static int qpwrpblock(const UC *input, size_t size, int left, int length,
+        t_mbuf *buffer);
+static const char *eolnext(const char *input, const char *last,
+        const char **cr, const char **lf);
 static void b64setup(UC *base);
-static size_t b64encode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
-static size_t b64pad(const UC *input, size_t size, luaL_Buffer *buffer);
-static size_t b64decode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
+static size_t b64encode(UC c, UC *input, size_t size, t_mbuf *buffer);
+static size_t b64pad(const UC *input, size_t size, t_mbuf *buffer);
+static size_t b64decode(UC c, UC *input, size_t size, t_mbuf *buffer);
+static size_t b64encodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer);
+static size_t b64decodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer);
 
 static void qpsetup(UC *class, UC *unbase);
-static void qpquote(UC c, luaL_Buffer *buffer);
-static size_t qpdecode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
+static void qpquote(UC c, t_mbuf *buffer);
+static size_t qpdecode(UC c, UC *input, size_t size, t_mbuf *buffer);
 static size_t qpencode(UC c, UC *input, size_t size,
-        const char *marker, luaL_Buffer *buffer);
-static size_t qppad(UC *input, size_t size, luaL_Buffer *buffer);
+        const char *marker, t_mbuf *buffer);
+static size_t qppad(UC *input, size_t size, t_mbuf *buffer);
+static size_t qpencodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, const char *marker, t_mbuf *buffer);
+static size_t qpdecodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer);
 
 /* code support functions */
 static luaL_Reg func[] = {
     { "dot", mime_global_dot },
     { "b64", mime_global_b64 },
+    { "chain", mime_global_chain },
     { "eol", mime_global_eol },
     { "qp", mime_global_qp },
     { "qpwrp", mime_global_qpwrp },
@@ -70,6 +115,42 @@ static const UC b64base[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static UC b64unbase[256];
 
+/*-------------------------------------------------------------------------*\
+* Chain globals
+\*-------------------------------------------------------------------------*/
+#define MIME_CHAIN "mime{chain}"
+#define MIME_MAXSTAGES 16
+
+/* filters that can be chained, in the order of the enum below */
+static const char *const chainnames[] = {
+    "b64", "unb64", "qp", "unqp", "eol", "dot", "wrp", "qpwrp", NULL
+};
+enum {CHAIN_B64, CHAIN_UNB64, CHAIN_QP, CHAIN_UNQP, CHAIN_EOL, CHAIN_DOT,
+    CHAIN_WRP, CHAIN_QPWRP};
+
+typedef struct t_stage_ {
+    int kind;
+    UC atom[4];         /* bytes waiting for the next call (b64, qp) */
+    size_t asize;
+    int ctx;            /* eol context, or bytes left in line (wrp, qpwrp) */
+    size_t state;       /* dot state */
+    int length;         /* line length (wrp, qpwrp) */
+    char *marker;       /* line break marker (qp, eol) */
+    t_mbuf out;         /* output, unless this is the last stage */
+} t_stage;
+
+typedef struct t_chain_ {
+    int n;
+    int done;           /* 1 once input has ended, 2 once output has too */
+    t_stage stage[MIME_MAXSTAGES];
+} t_chain;
+
+static luaL_Reg chain_meth[] = {
+    { "__call", chain_meth_call },
+    { "__gc", chain_meth_gc },
+    { NULL, NULL }
+};
+
 /*=========================================================================*\
 * Exported functions
 \*=========================================================================*/
@@ -84,12 +165,112 @@ MIME_API int luaopen_mime_core(lua_State *L)
     lua_pushstring(L, "_VERSION");
     lua_pushstring(L, MIME_VERSION);
     lua_rawset(L, -3);
+    /* metatable for chain objects */
+    luaL_newmetatable(L, MIME_CHAIN);
+    luaL_setfuncs(L, chain_meth, 0);
+    lua_pop(L, 1);
     /* initialize lookup tables */
     qpsetup(qpclass, qpunbase);
     b64setup(b64unbase);
     return 1;
 }
 
+/*=========================================================================*\
+* Output buffers
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Gets an optional input chunk, which can be a string or a LuaSocket bytes
+* object. Bytes objects are read in place, without making a string
+\*-------------------------------------------------------------------------*/
+static const char *mime_optinput(lua_State *L, int narg, size_t *size)
+{
+    if (lua_type(L, narg) == LUA_TUSERDATA && lua_getmetatable(L, narg)) {
+        int isbytes;
+        lua_pushstring(L, "bytes{any}");
+        lua_rawget(L, -2);
+        isbytes = !lua_isnil(L, -1);
+        lua_pop(L, 2);
+        if (isbytes) {
+            p_bytes b = (p_bytes) lua_touserdata(L, narg);
+            *size = b->size;
+            return b->data? b->data: "";
+        }
+    }
+    return luaL_optlstring(L, narg, NULL, size);
+}
+
+/*-------------------------------------------------------------------------*\
+* Initializes a Lua buffer and makes it the destination of mb
+\*-------------------------------------------------------------------------*/
+static void mbuf_buffinit(lua_State *L, t_mbuf *mb, luaL_Buffer *lb)
+{
+    luaL_buffinit(L, lb);
+    mb->lb = lb;
+    mb->L = L;
+    mb->data = NULL;
+    mb->n = mb->size = 0;
+}
+
+/*-------------------------------------------------------------------------*\
+* Reserves room for up to 'wanted' bytes at the end of buffer. Lua 5.1 can
+* only hand out LUAL_BUFFERSIZE bytes at a time, so 'size' receives what
+* was actually reserved. The caller must mbuf_addsize what it used.
+\*-------------------------------------------------------------------------*/
+static char *mbuf_reserve(t_mbuf *mb, size_t wanted, size_t *size)
+{
+    if (mb->lb) {
+#if LUA_VERSION_NUM > 501
+        *size = wanted;
+        return luaL_prepbuffsize(mb->lb, wanted);
+#else
+        *size = wanted < LUAL_BUFFERSIZE? wanted: LUAL_BUFFERSIZE;
+        return luaL_prepbuffer(mb->lb);
+#endif
+    }
+    if (mb->size - mb->n < wanted) {
+        size_t grown = mb->size > 0? mb->size: LUAL_BUFFERSIZE;
+        char *data;
+        while (grown - mb->n < wanted) grown *= 2;
+        data = (char *) realloc(mb->data, grown);
+        if (!data) luaL_error(mb->L, "not enough memory");
+        mb->data = data;
+        mb->size = grown;
+    }
+    *size = wanted;
+    return mb->data + mb->n;
+}
+
+static void mbuf_addsize(t_mbuf *mb, size_t n)
+{
+    if (mb->lb) luaL_addsize(mb->lb, n);
+    else mb->n += n;
+}
+
+static void mbuf_addchar(t_mbuf *mb, char c)
+{
+    if (mb->lb) luaL_addchar(mb->lb, c);
+    else {
+        size_t room;
+        if (mb->n >= mb->size) mbuf_reserve(mb, 1, &room);
+        mb->data[mb->n++] = c;
+    }
+}
+
+static void mbuf_addlstring(t_mbuf *mb, const char *s, size_t len)
+{
+    if (mb->lb) luaL_addlstring(mb->lb, s, len);
+    else if (len > 0) {
+        size_t room;
+        memcpy(mbuf_reserve(mb, len, &room), s, len);
+        mb->n += len;
+    }
+}
+
+static void mbuf_addstring(t_mbuf *mb, const char *s)
+{
+    mbuf_addlstring(mb, s, strlen(s));
+}
+
 /*=========================================================================*\
 * Global Lua functions
 \*=========================================================================*/
@@ -104,10 +285,10 @@ static int mime_global_wrp(lua_State *L)
 {
     size_t size = 0;
     int left = (int) luaL_checknumber(L, 1);
-    const UC *input = (const UC *) luaL_optlstring(L, 2, NULL, &size);
-    const UC *last = input + size;
+    const UC *input = (const UC *) mime_optinput(L, 2, &size);
     int length = (int) luaL_optnumber(L, 3, 76);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end of input black-hole */
     if (!input) {
         /* if last line has not been terminated, add a line break */
@@ -117,29 +298,53 @@ static int mime_global_wrp(lua_State *L)
         lua_pushnumber(L, length);
         return 2;
     }
-    luaL_buffinit(L, &buffer);
+    mbuf_buffinit(L, &out, &buffer);
+    left = wrpblock(input, size, left, length, &out);
+    luaL_pushresult(&buffer);
+    lua_pushnumber(L, left);
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Breaks a whole span into lines, copying as much of each line as fits.
+* Returns how many bytes are left in the last line.
+\*-------------------------------------------------------------------------*/
+static int wrpblock(const UC *input, size_t size, int left, int length,
+        t_mbuf *buffer)
+{
+    const UC *last = input + size;
+    const char *cr = NULL, *lf = NULL;
     while (input < last) {
         switch (*input) {
             case '\r':
                 break;
             case '\n':
-                luaL_addstring(&buffer, CRLF);
+                mbuf_addstring(buffer, CRLF);
                 left = length;
                 break;
             default:
                 if (left <= 0) {
                     left = length;
-                    luaL_addstring(&buffer, CRLF);
+                    mbuf_addstring(buffer, CRLF);
                 }
-                luaL_addchar(&buffer, *input);
+                /* copy as much of the line as fits */
+                if (left > 0) {
+                    const UC *stop = (const UC *) eolnext((const char *) input,
+                        (const char *) last, &cr, &lf);
+                    size_t count = (size_t) (stop - input);
+                    if (count > (size_t) left) count = (size_t) left;
+                    mbuf_addlstring(buffer, (const char *) input, count);
+                    left -= (int) count;
+                    input += count;
+                    continue;
+                }
+                mbuf_addchar(buffer, *input);
                 left--;
                 break;
         }
         input++;
     }
-    luaL_pushresult(&buffer);
-    lua_pushnumber(L, left);
-    return 2;
+    return left;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -159,7 +364,7 @@ static void b64setup(UC *unbase)
 * Returns new number of bytes in buffer.
 \*-------------------------------------------------------------------------*/
 static size_t b64encode(UC c, UC *input, size_t size,
-        luaL_Buffer *buffer)
+        t_mbuf *buffer)
 {
     input[size++] = c;
     if (size == 3) {
@@ -172,7 +377,7 @@ static size_t b64encode(UC c, UC *input, size_t size,
         code[2] = b64base[value & 0x3f]; value >>= 6;
         code[1] = b64base[value & 0x3f]; value >>= 6;
         code[0] = b64base[value];
-        luaL_addlstring(buffer, (char *) code, 4);
+        mbuf_addlstring(buffer, (char *) code, 4);
         size = 0;
     }
     return size;
@@ -184,7 +389,7 @@ static size_t b64encode(UC c, UC *input, size_t size,
 * Returns 0.
 \*-------------------------------------------------------------------------*/
 static size_t b64pad(const UC *input, size_t size,
-        luaL_Buffer *buffer)
+        t_mbuf *buffer)
 {
     unsigned long value = 0;
     UC code[4] = {'=', '=', '=', '='};
@@ -193,7 +398,7 @@ static size_t b64pad(const UC *input, size_t size,
             value = input[0] << 4;
             code[1] = b64base[value & 0x3f]; value >>= 6;
             code[0] = b64base[value];
-            luaL_addlstring(buffer, (char *) code, 4);
+            mbuf_addlstring(buffer, (char *) code, 4);
             break;
         case 2:
             value = input[0]; value <<= 8;
@@ -201,7 +406,7 @@ static size_t b64pad(const UC *input, size_t size,
             code[2] = b64base[value & 0x3f]; value >>= 6;
             code[1] = b64base[value & 0x3f]; value >>= 6;
             code[0] = b64base[value];
-            luaL_addlstring(buffer, (char *) code, 4);
+            mbuf_addlstring(buffer, (char *) code, 4);
             break;
         default:
             break;
@@ -215,7 +420,7 @@ static size_t b64pad(const UC *input, size_t size,
 * Returns new number of bytes in buffer.
 \*-------------------------------------------------------------------------*/
 static size_t b64decode(UC c, UC *input, size_t size,
-        luaL_Buffer *buffer)
+        t_mbuf *buffer)
 {
     /* ignore invalid characters */
     if (b64unbase[c] > 64) return size;
@@ -233,12 +438,81 @@ static size_t b64decode(UC c, UC *input, size_t size,
         decoded[0] = (UC) value;
         /* take care of paddding */
         valid = (input[2] == '=') ? 1 : (input[3] == '=') ? 2 : 3;
-        luaL_addlstring(buffer, (char *) decoded, valid);
+        mbuf_addlstring(buffer, (char *) decoded, valid);
         return 0;
     /* need more data */
     } else return size;
 }
 
+/*-------------------------------------------------------------------------*\
+* Base64 encodes a whole span. A pending atom is completed byte by byte,
+* then full atoms are encoded straight into the buffer, and the 0 to 2
+* bytes left over go back into the atom.
+* Returns new number of bytes in atom.
+\*-------------------------------------------------------------------------*/
+static size_t b64encodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer)
+{
+    const UC *last = input + isize;
+    while (asize > 0 && input < last)
+        asize = b64encode(*input++, atom, asize, buffer);
+    while (last - input >= 3) {
+        size_t i, room, n = (size_t) (last - input)/3;
+        UC *code = (UC *) mbuf_reserve(buffer, 4*n, &room);
+        n = room/4;
+        for (i = 0; i < n; i++) {
+            unsigned long value = ((unsigned long) input[0] << 16) |
+                ((unsigned long) input[1] << 8) | input[2];
+            code[0] = b64base[value >> 18];
+            code[1] = b64base[(value >> 12) & 0x3f];
+            code[2] = b64base[(value >> 6) & 0x3f];
+            code[3] = b64base[value & 0x3f];
+            input += 3;
+            code += 4;
+        }
+        mbuf_addsize(buffer, 4*n);
+    }
+    while (input < last)
+        asize = b64encode(*input++, atom, asize, buffer);
+    return asize;
+}
+
+/*-------------------------------------------------------------------------*\
+* Base64 decodes a whole span. Runs of complete atoms made only of valid
+* characters are decoded straight into the buffer. Line breaks, invalid
+* characters and padding go through b64decode, one byte at a time, until
+* the atom is empty again.
+* Returns new number of bytes in atom.
+\*-------------------------------------------------------------------------*/
+static size_t b64decodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer)
+{
+    const UC *last = input + isize;
+    while (input < last) {
+        if (asize == 0 && last - input >= 4) {
+            size_t i, room, n = (size_t) (last - input)/4;
+            UC *decoded = (UC *) mbuf_reserve(buffer, 3*n, &room);
+            n = room/3;
+            for (i = 0; i < n; i++) {
+                unsigned long a = b64unbase[input[0]], b = b64unbase[input[1]],
+                    c = b64unbase[input[2]], d = b64unbase[input[3]], value;
+                if ((a | b | c | d) > 63 || input[2] == '=' || input[3] == '=')
+                    break;
+                value = (a << 18) | (b << 12) | (c << 6) | d;
+                decoded[0] = (UC) (value >> 16);
+                decoded[1] = (UC) (value >> 8);
+                decoded[2] = (UC) value;
+                input += 4;
+                decoded += 3;
+            }
+            mbuf_addsize(buffer, 3*i);
+            if (i == n) continue;
+        }
+        asize = b64decode(*input++, atom, asize, buffer);
+    }
+    return asize;
+}
+
 /*-------------------------------------------------------------------------*\
 * Incrementally applies the Base64 transfer content encoding to a string
 * A, B = b64(C, D)
@@ -252,9 +526,9 @@ static int mime_global_b64(lua_State *L)
 {
     UC atom[3];
     size_t isize = 0, asize = 0;
-    const UC *input = (const UC *) luaL_optlstring(L, 1, NULL, &isize);
-    const UC *last = input + isize;
+    const UC *input = (const UC *) mime_optinput(L, 1, &isize);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         lua_pushnil(L);
@@ -264,14 +538,13 @@ static int mime_global_b64(lua_State *L)
     /* make sure we don't confuse buffer stuff with arguments */
     lua_settop(L, 2);
     /* process first part of the input */
-    luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = b64encode(*input++, atom, asize, &buffer);
-    input = (const UC *) luaL_optlstring(L, 2, NULL, &isize);
+    mbuf_buffinit(L, &out, &buffer);
+    asize = b64encodeblock(input, isize, atom, asize, &out);
+    input = (const UC *) mime_optinput(L, 2, &isize);
     /* if second part is nil, we are done */
     if (!input) {
         size_t osize = 0;
-        asize = b64pad(atom, asize, &buffer);
+        asize = b64pad(atom, asize, &out);
         luaL_pushresult(&buffer);
         /* if the output is empty  and the input is nil, return nil */
         lua_tolstring(L, -1, &osize);
@@ -280,9 +553,7 @@ static int mime_global_b64(lua_State *L)
         return 2;
     }
     /* otherwise process the second part */
-    last = input + isize;
-    while (input < last)
-        asize = b64encode(*input++, atom, asize, &buffer);
+    asize = b64encodeblock(input, isize, atom, asize, &out);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -298,9 +569,9 @@ static int mime_global_unb64(lua_State *L)
 {
     UC atom[4];
     size_t isize = 0, asize = 0;
-    const UC *input = (const UC *) luaL_optlstring(L, 1, NULL, &isize);
-    const UC *last = input + isize;
+    const UC *input = (const UC *) mime_optinput(L, 1, &isize);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         lua_pushnil(L);
@@ -310,10 +581,9 @@ static int mime_global_unb64(lua_State *L)
     /* make sure we don't confuse buffer stuff with arguments */
     lua_settop(L, 2);
     /* process first part of the input */
-    luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = b64decode(*input++, atom, asize, &buffer);
-    input = (const UC *) luaL_optlstring(L, 2, NULL, &isize);
+    mbuf_buffinit(L, &out, &buffer);
+    asize = b64decodeblock(input, isize, atom, asize, &out);
+    input = (const UC *) mime_optinput(L, 2, &isize);
     /* if second is nil, we are done */
     if (!input) {
         size_t osize = 0;
@@ -325,9 +595,7 @@ static int mime_global_unb64(lua_State *L)
         return 2;
     }
     /* otherwise, process the rest of the input */
-    last = input + isize;
-    while (input < last)
-        asize = b64decode(*input++, atom, asize, &buffer);
+    asize = b64decodeblock(input, isize, atom, asize, &out);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -372,11 +640,11 @@ static void qpsetup(UC *cl, UC *unbase)
 /*-------------------------------------------------------------------------*\
 * Output one character in form =XX
 \*-------------------------------------------------------------------------*/
-static void qpquote(UC c, luaL_Buffer *buffer)
+static void qpquote(UC c, t_mbuf *buffer)
 {
-    luaL_addchar(buffer, '=');
-    luaL_addchar(buffer, qpbase[c >> 4]);
-    luaL_addchar(buffer, qpbase[c & 0x0F]);
+    mbuf_addchar(buffer, '=');
+    mbuf_addchar(buffer, qpbase[c >> 4]);
+    mbuf_addchar(buffer, qpbase[c & 0x0F]);
 }
 
 /*-------------------------------------------------------------------------*\
@@ -384,7 +652,7 @@ static void qpquote(UC c, luaL_Buffer *buffer)
 * Once we are sure, output to the buffer, in the correct form.
 \*-------------------------------------------------------------------------*/
 static size_t qpencode(UC c, UC *input, size_t size,
-        const char *marker, luaL_Buffer *buffer)
+        const char *marker, t_mbuf *buffer)
 {
     input[size++] = c;
     /* deal with all characters we can have */
@@ -394,7 +662,7 @@ static size_t qpencode(UC c, UC *input, size_t size,
             case QP_CR:
                 if (size < 2) return size;
                 if (input[1] == '\n') {
-                    luaL_addstring(buffer, marker);
+                    mbuf_addstring(buffer, marker);
                     return 0;
                 } else qpquote(input[0], buffer);
                 break;
@@ -404,9 +672,9 @@ static size_t qpencode(UC c, UC *input, size_t size,
                 /* if it is the last, quote it and we are done */
                 if (input[1] == '\r' && input[2] == '\n') {
                     qpquote(input[0], buffer);
-                    luaL_addstring(buffer, marker);
+                    mbuf_addstring(buffer, marker);
                     return 0;
-                } else luaL_addchar(buffer, input[0]);
+                } else mbuf_addchar(buffer, input[0]);
                 break;
                 /* might have to be quoted always */
             case QP_QUOTED:
@@ -414,7 +682,7 @@ static size_t qpencode(UC c, UC *input, size_t size,
                 break;
                 /* might never have to be quoted */
             default:
-                luaL_addchar(buffer, input[0]);
+                mbuf_addchar(buffer, input[0]);
                 break;
         }
         input[0] = input[1]; input[1] = input[2];
@@ -423,17 +691,45 @@ static size_t qpencode(UC c, UC *input, size_t size,
     return 0;
 }
 
+/*-------------------------------------------------------------------------*\
+* Quoted-printable encodes a whole span. While nothing is pending, runs of
+* characters that can be output as they are, including spaces and tabs
+* that are known not to end a line, are copied with a single call.
+* Everything else goes through qpencode, which decides how to deal with it.
+* Returns new number of bytes in atom.
+\*-------------------------------------------------------------------------*/
+static size_t qpencodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, const char *marker, t_mbuf *buffer)
+{
+    const UC *last = input + isize;
+    while (input < last) {
+        if (asize == 0) {
+            const UC *run = input;
+            /* a space or tab is plain too, unless it ends a line */
+            while (input < last && (qpclass[*input] == QP_PLAIN ||
+                    (qpclass[*input] == QP_IF_LAST && last - input > 2 &&
+                    !(input[1] == '\r' && input[2] == '\n'))))
+                input++;
+            if (input > run)
+                mbuf_addlstring(buffer, (const char *) run, input - run);
+            if (input >= last) break;
+        }
+        asize = qpencode(*input++, atom, asize, marker, buffer);
+    }
+    return asize;
+}
+
 /*-------------------------------------------------------------------------*\
 * Deal with the final characters
 \*-------------------------------------------------------------------------*/
-static size_t qppad(UC *input, size_t size, luaL_Buffer *buffer)
+static size_t qppad(UC *input, size_t size, t_mbuf *buffer)
 {
     size_t i;
     for (i = 0; i < size; i++) {
-        if (qpclass[input[i]] == QP_PLAIN) luaL_addchar(buffer, input[i]);
+        if (qpclass[input[i]] == QP_PLAIN) mbuf_addchar(buffer, input[i]);
         else qpquote(input[i], buffer);
     }
-    if (size > 0) luaL_addstring(buffer, EQCRLF);
+    if (size > 0) mbuf_addstring(buffer, EQCRLF);
     return 0;
 }
 
@@ -450,10 +746,10 @@ static int mime_global_qp(lua_State *L)
 
     size_t asize = 0, isize = 0;
     UC atom[3];
-    const UC *input = (const UC *) luaL_optlstring(L, 1, NULL, &isize);
-    const UC *last = input + isize;
+    const UC *input = (const UC *) mime_optinput(L, 1, &isize);
     const char *marker = luaL_optstring(L, 3, CRLF);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         lua_pushnil(L);
@@ -463,22 +759,19 @@ static int mime_global_qp(lua_State *L)
     /* make sure we don't confuse buffer stuff with arguments */
     lua_settop(L, 3);
     /* process first part of input */
-    luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = qpencode(*input++, atom, asize, marker, &buffer);
-    input = (const UC *) luaL_optlstring(L, 2, NULL, &isize);
+    mbuf_buffinit(L, &out, &buffer);
+    asize = qpencodeblock(input, isize, atom, asize, marker, &out);
+    input = (const UC *) mime_optinput(L, 2, &isize);
     /* if second part is nil, we are done */
     if (!input) {
-        asize = qppad(atom, asize, &buffer);
+        asize = qppad(atom, asize, &out);
         luaL_pushresult(&buffer);
         if (!(*lua_tostring(L, -1))) lua_pushnil(L);
         lua_pushnil(L);
         return 2;
     }
     /* otherwise process rest of input */
-    last = input + isize;
-    while (input < last)
-        asize = qpencode(*input++, atom, asize, marker, &buffer);
+    asize = qpencodeblock(input, isize, atom, asize, marker, &out);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -488,7 +781,7 @@ static int mime_global_qp(lua_State *L)
 * Accumulate characters until we are sure about how to deal with them.
 * Once we are sure, output the to the buffer, in the correct form.
 \*-------------------------------------------------------------------------*/
-static size_t qpdecode(UC c, UC *input, size_t size, luaL_Buffer *buffer) {
+static size_t qpdecode(UC c, UC *input, size_t size, t_mbuf *buffer) {
     int d;
     input[size++] = c;
     /* deal with all characters we can deal */
@@ -501,20 +794,44 @@ static size_t qpdecode(UC c, UC *input, size_t size, luaL_Buffer *buffer) {
             /* decode quoted representation */
             c = qpunbase[input[1]]; d = qpunbase[input[2]];
             /* if it is an invalid, do not decode */
-            if (c > 15 || d > 15) luaL_addlstring(buffer, (char *)input, 3);
-            else luaL_addchar(buffer, (char) ((c << 4) + d));
+            if (c > 15 || d > 15) mbuf_addlstring(buffer, (char *)input, 3);
+            else mbuf_addchar(buffer, (char) ((c << 4) + d));
             return 0;
         case '\r':
             if (size < 2) return size;
-            if (input[1] == '\n') luaL_addlstring(buffer, (char *)input, 2);
+            if (input[1] == '\n') mbuf_addlstring(buffer, (char *)input, 2);
             return 0;
         default:
             if (input[0] == '\t' || (input[0] > 31 && input[0] < 127))
-                luaL_addchar(buffer, input[0]);
+                mbuf_addchar(buffer, input[0]);
             return 0;
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Decodes a whole span of quoted-printable. While nothing is pending, runs
+* of characters that stand for themselves are copied with a single call.
+* Escapes, line breaks and characters to be dropped go through qpdecode.
+* Returns new number of bytes in atom.
+\*-------------------------------------------------------------------------*/
+#define qpliteral(c) ((c) == '\t' || ((c) > 31 && (c) < 127 && (c) != '='))
+static size_t qpdecodeblock(const UC *input, size_t isize, UC *atom,
+        size_t asize, t_mbuf *buffer)
+{
+    const UC *last = input + isize;
+    while (input < last) {
+        if (asize == 0) {
+            const UC *run = input;
+            while (input < last && qpliteral(*input)) input++;
+            if (input > run)
+                mbuf_addlstring(buffer, (const char *) run, input - run);
+            if (input >= last) break;
+        }
+        asize = qpdecode(*input++, atom, asize, buffer);
+    }
+    return asize;
+}
+
 /*-------------------------------------------------------------------------*\
 * Incrementally decodes a string in quoted-printable
 * A, B = qp(C, D)
@@ -526,9 +843,9 @@ static int mime_global_unqp(lua_State *L)
 {
     size_t asize = 0, isize = 0;
     UC atom[3];
-    const UC *input = (const UC *) luaL_optlstring(L, 1, NULL, &isize);
-    const UC *last = input + isize;
+    const UC *input = (const UC *) mime_optinput(L, 1, &isize);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         lua_pushnil(L);
@@ -538,10 +855,9 @@ static int mime_global_unqp(lua_State *L)
     /* make sure we don't confuse buffer stuff with arguments */
     lua_settop(L, 2);
     /* process first part of input */
-    luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = qpdecode(*input++, atom, asize, &buffer);
-    input = (const UC *) luaL_optlstring(L, 2, NULL, &isize);
+    mbuf_buffinit(L, &out, &buffer);
+    asize = qpdecodeblock(input, isize, atom, asize, &out);
+    input = (const UC *) mime_optinput(L, 2, &isize);
     /* if second part is nil, we are done */
     if (!input) {
         luaL_pushresult(&buffer);
@@ -550,9 +866,7 @@ static int mime_global_unqp(lua_State *L)
         return 2;
     }
     /* otherwise process rest of input */
-    last = input + isize;
-    while (input < last)
-        asize = qpdecode(*input++, atom, asize, &buffer);
+    asize = qpdecodeblock(input, isize, atom, asize, &out);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -571,10 +885,10 @@ static int mime_global_qpwrp(lua_State *L)
 {
     size_t size = 0;
     int left = (int) luaL_checknumber(L, 1);
-    const UC *input = (const UC *) luaL_optlstring(L, 2, NULL, &size);
-    const UC *last = input + size;
+    const UC *input = (const UC *) mime_optinput(L, 2, &size);
     int length = (int) luaL_optnumber(L, 3, 76);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         if (left < length) lua_pushstring(L, EQCRLF);
@@ -583,37 +897,79 @@ static int mime_global_qpwrp(lua_State *L)
         return 2;
     }
     /* process all input */
-    luaL_buffinit(L, &buffer);
+    mbuf_buffinit(L, &out, &buffer);
+    left = qpwrpblock(input, size, left, length, &out);
+    luaL_pushresult(&buffer);
+    lua_pushnumber(L, left);
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Breaks a whole span of quoted-printable into lines.
+* Returns how many bytes are left in the last line.
+\*-------------------------------------------------------------------------*/
+static int qpwrpblock(const UC *input, size_t size, int left, int length,
+        t_mbuf *buffer)
+{
+    const UC *last = input + size;
     while (input < last) {
         switch (*input) {
             case '\r':
                 break;
             case '\n':
                 left = length;
-                luaL_addstring(&buffer, CRLF);
+                mbuf_addstring(buffer, CRLF);
                 break;
             case '=':
                 if (left <= 3) {
                     left = length;
-                    luaL_addstring(&buffer, EQCRLF);
+                    mbuf_addstring(buffer, EQCRLF);
                 }
-                luaL_addchar(&buffer, *input);
+                mbuf_addchar(buffer, *input);
                 left--;
                 break;
             default:
                 if (left <= 1) {
                     left = length;
-                    luaL_addstring(&buffer, EQCRLF);
+                    mbuf_addstring(buffer, EQCRLF);
                 }
-                luaL_addchar(&buffer, *input);
+                /* copy as much of the run as fits in the line */
+                if (left > 1) {
+                    const UC *run = input;
+                    const UC *stop = last - input < left - 1?
+                        last: input + (left - 1);
+                    while (input < stop && *input != '\r' &&
+                            *input != '\n' && *input != '=') input++;
+                    mbuf_addlstring(buffer, (const char *) run, input - run);
+                    left -= (int) (input - run);
+                    continue;
+                }
+                mbuf_addchar(buffer, *input);
                 left--;
                 break;
         }
         input++;
     }
-    luaL_pushresult(&buffer);
-    lua_pushnumber(L, left);
-    return 2;
+    return left;
+}
+
+/*-------------------------------------------------------------------------*\
+* Finds the next CR or LF in a span, or its end. cr and lf remember where
+* each was last found, so the span is only searched once for each. A NULL
+* cr means nothing has been searched yet.
+\*-------------------------------------------------------------------------*/
+static const char *eolnext(const char *input, const char *last,
+        const char **cr, const char **lf)
+{
+    if (!*cr || *cr < input) {
+        *cr = (const char *) memchr(input, '\r', (size_t) (last - input));
+        if (!*cr) *cr = last;
+    }
+    if (!*lf || *lf < input) {
+        *lf = (const char *) memchr(input, '\n', (size_t) (last - input));
+        if (!*lf) *lf = last;
+    }
+    return *cr < *lf? *cr: *lf;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -629,18 +985,18 @@ static int mime_global_qpwrp(lua_State *L)
 \*-------------------------------------------------------------------------*/
 #define eolcandidate(c) (c == '\r' || c == '\n')
 static int eolprocess(int c, int last, const char *marker,
-        luaL_Buffer *buffer)
+        t_mbuf *buffer)
 {
     if (eolcandidate(c)) {
         if (eolcandidate(last)) {
-            if (c == last) luaL_addstring(buffer, marker);
+            if (c == last) mbuf_addstring(buffer, marker);
             return 0;
         } else {
-            luaL_addstring(buffer, marker);
+            mbuf_addstring(buffer, marker);
             return c;
         }
     } else {
-        luaL_addchar(buffer, (char) c);
+        mbuf_addchar(buffer, (char) c);
         return 0;
     }
 }
@@ -656,31 +1012,49 @@ static int mime_global_eol(lua_State *L)
 {
     int ctx = luaL_checkinteger(L, 1);
     size_t isize = 0;
-    const char *input = luaL_optlstring(L, 2, NULL, &isize);
-    const char *last = input + isize;
+    const char *input = mime_optinput(L, 2, &isize);
     const char *marker = luaL_optstring(L, 3, CRLF);
     luaL_Buffer buffer;
-    luaL_buffinit(L, &buffer);
+    t_mbuf out;
+    mbuf_buffinit(L, &out, &buffer);
     /* end of input blackhole */
     if (!input) {
        lua_pushnil(L);
        lua_pushnumber(L, 0);
        return 2;
     }
-    /* process all input */
-    while (input < last)
-        ctx = eolprocess(*input++, ctx, marker, &buffer);
+    ctx = eolblock(input, isize, ctx, marker, &out);
     luaL_pushresult(&buffer);
     lua_pushnumber(L, ctx);
     return 2;
 }
 
+/*-------------------------------------------------------------------------*\
+* Converts a whole span, copying the text between candidates at once.
+* Returns the new context.
+\*-------------------------------------------------------------------------*/
+static int eolblock(const char *input, size_t size, int ctx,
+        const char *marker, t_mbuf *buffer)
+{
+    const char *last = input + size;
+    const char *cr = NULL, *lf = NULL;
+    while (input < last) {
+        const char *stop = eolnext(input, last, &cr, &lf);
+        if (stop > input) {
+            mbuf_addlstring(buffer, input, (size_t) (stop - input));
+            input = stop;
+            ctx = 0;
+        } else ctx = eolprocess(*input++, ctx, marker, buffer);
+    }
+    return ctx;
+}
+
 /*-------------------------------------------------------------------------*\
 * Takes one byte and stuff it if needed.
 \*-------------------------------------------------------------------------*/
-static size_t dot(int c, size_t state, luaL_Buffer *buffer)
+static size_t dot(int c, size_t state, t_mbuf *buffer)
 {
-    luaL_addchar(buffer, (char) c);
+    mbuf_addchar(buffer, (char) c);
     switch (c) {
         case '\r':
             return 1;
@@ -688,7 +1062,7 @@ static size_t dot(int c, size_t state, luaL_Buffer *buffer)
             return (state == 1)? 2: 0;
         case '.':
             if (state == 2)
-                luaL_addchar(buffer, '.');
+                mbuf_addchar(buffer, '.');
         default:
             return 0;
     }
@@ -701,21 +1075,247 @@ static size_t dot(int c, size_t state, luaL_Buffer *buffer)
 static int mime_global_dot(lua_State *L)
 {
     size_t isize = 0, state = (size_t) luaL_checknumber(L, 1);
-    const char *input = luaL_optlstring(L, 2, NULL, &isize);
-    const char *last = input + isize;
+    const char *input = mime_optinput(L, 2, &isize);
     luaL_Buffer buffer;
+    t_mbuf out;
     /* end-of-input blackhole */
     if (!input) {
         lua_pushnil(L);
         lua_pushnumber(L, 2);
         return 2;
     }
-    /* process all input */
-    luaL_buffinit(L, &buffer);
-    while (input < last)
-        state = dot(*input++, state, &buffer);
+    mbuf_buffinit(L, &out, &buffer);
+    state = dotblock(input, isize, state, &out);
     luaL_pushresult(&buffer);
     lua_pushnumber(L, (lua_Number) state);
     return 2;
 }
 
+/*-------------------------------------------------------------------------*\
+* Stuffs a whole span, copying the text between line breaks at once. Only
+* a dot right after CRLF needs to be looked at.
+* Returns the new state.
+\*-------------------------------------------------------------------------*/
+static size_t dotblock(const char *input, size_t size, size_t state,
+        t_mbuf *buffer)
+{
+    const char *last = input + size;
+    const char *cr = NULL, *lf = NULL;
+    while (input < last) {
+        const char *stop = eolnext(input, last, &cr, &lf);
+        if (stop > input && !(state == 2 && *input == '.')) {
+            mbuf_addlstring(buffer, input, (size_t) (stop - input));
+            input = stop;
+            state = 0;
+        } else state = dot(*input++, state, buffer);
+    }
+    return state;
+}
+
+/*=========================================================================*\
+* Filter chains
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates a chain of filters that runs in a single pass
+* f = chain(S1, S2, ...)
+* Each S is a filter name, or a table {name, parameter} where the
+* parameter is the marker of qp and eol, or the line length of wrp and
+* qpwrp. Intermediate results go to memory owned by f and only the output
+* of the last filter becomes a Lua string. f follows the LTN12 filter
+* protocol.
+\*-------------------------------------------------------------------------*/
+static int mime_global_chain(lua_State *L)
+{
+    int i, n = lua_gettop(L);
+    t_chain *chain;
+    luaL_argcheck(L, n > 0, 1, "filter expected");
+    luaL_argcheck(L, n <= MIME_MAXSTAGES, MIME_MAXSTAGES+1,
+        "too many filters");
+    chain = (t_chain *) lua_newuserdata(L, sizeof(t_chain));
+    memset(chain, 0, sizeof(t_chain));
+    luaL_getmetatable(L, MIME_CHAIN);
+    lua_setmetatable(L, -2);
+    for (i = 0; i < n; i++) {
+        t_stage *stage = &chain->stage[i];
+        const char *name, *marker = CRLF;
+        int arg = i+1, param = n+3;
+        if (lua_istable(L, arg)) {
+            lua_rawgeti(L, arg, 1);
+            lua_rawgeti(L, arg, 2);
+        } else {
+            lua_pushvalue(L, arg);
+            lua_pushnil(L);
+        }
+        name = lua_tostring(L, param-1);
+        if (!name) luaL_argerror(L, arg, "filter name expected");
+        for (stage->kind = 0; chainnames[stage->kind]; stage->kind++)
+            if (strcmp(chainnames[stage->kind], name) == 0) break;
+        if (!chainnames[stage->kind])
+            luaL_argerror(L, arg, lua_pushfstring(L, "unknown filter '%s'",
+                name));
+        switch (stage->kind) {
+            case CHAIN_QP:
+            case CHAIN_EOL:
+                if (!lua_isnil(L, param)) {
+                    if (!lua_isstring(L, param))
+                        luaL_argerror(L, arg, "marker must be a string");
+                    marker = lua_tostring(L, param);
+                }
+                stage->marker = (char *) malloc(strlen(marker)+1);
+                if (!stage->marker) return luaL_error(L, "not enough memory");
+                strcpy(stage->marker, marker);
+                break;
+            case CHAIN_DOT:
+                stage->state = 2;
+                break;
+            case CHAIN_WRP:
+            case CHAIN_QPWRP:
+                stage->length = 76;
+                if (!lua_isnil(L, param)) {
+                    if (!lua_isnumber(L, param))
+                        luaL_argerror(L, arg, "length must be a number");
+                    stage->length = (int) lua_tonumber(L, param);
+                }
+                stage->ctx = stage->length;
+                break;
+            default:
+                break;
+        }
+        chain->n++;
+        lua_settop(L, n+1);
+    }
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Runs a span through one stage
+\*-------------------------------------------------------------------------*/
+static void chain_stage(t_stage *stage, const UC *input, size_t size,
+        t_mbuf *out)
+{
+    switch (stage->kind) {
+        case CHAIN_B64:
+            stage->asize = b64encodeblock(input, size, stage->atom,
+                stage->asize, out);
+            break;
+        case CHAIN_UNB64:
+            stage->asize = b64decodeblock(input, size, stage->atom,
+                stage->asize, out);
+            break;
+        case CHAIN_QP:
+            stage->asize = qpencodeblock(input, size, stage->atom,
+                stage->asize, stage->marker, out);
+            break;
+        case CHAIN_UNQP:
+            stage->asize = qpdecodeblock(input, size, stage->atom,
+                stage->asize, out);
+            break;
+        case CHAIN_EOL:
+            stage->ctx = eolblock((const char *) input, size, stage->ctx,
+                stage->marker, out);
+            break;
+        case CHAIN_DOT:
+            stage->state = dotblock((const char *) input, size,
+                stage->state, out);
+            break;
+        case CHAIN_WRP:
+            stage->ctx = wrpblock(input, size, stage->ctx, stage->length, out);
+            break;
+        case CHAIN_QPWRP:
+            stage->ctx = qpwrpblock(input, size, stage->ctx, stage->length,
+                out);
+            break;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Flushes whatever a stage was holding back once input has ended
+\*-------------------------------------------------------------------------*/
+static void chain_flush(t_stage *stage, t_mbuf *out)
+{
+    switch (stage->kind) {
+        case CHAIN_B64:
+            stage->asize = b64pad(stage->atom, stage->asize, out);
+            break;
+        case CHAIN_QP:
+            stage->asize = qppad(stage->atom, stage->asize, out);
+            break;
+        case CHAIN_WRP:
+            if (stage->ctx < stage->length) mbuf_addstring(out, CRLF);
+            stage->ctx = stage->length;
+            break;
+        case CHAIN_QPWRP:
+            if (stage->ctx < stage->length) mbuf_addstring(out, EQCRLF);
+            stage->ctx = stage->length;
+            break;
+        default:
+            stage->asize = 0;
+            break;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Filters a chunk through all stages. A nil chunk flushes every stage in
+* turn, so that what one holds back still goes through the ones after it.
+\*-------------------------------------------------------------------------*/
+static int chain_meth_call(lua_State *L)
+{
+    t_chain *chain = (t_chain *) luaL_checkudata(L, 1, MIME_CHAIN);
+    size_t size = 0;
+    const UC *input = (const UC *) mime_optinput(L, 2, &size);
+    luaL_Buffer buffer;
+    t_mbuf out;
+    int i, end = !input;
+    /* once input has ended, only more nils are accepted */
+    if (chain->done && !end) return luaL_error(L, "chain has already ended");
+    if (chain->done) {
+        chain->done = 2;
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_settop(L, 2);
+    mbuf_buffinit(L, &out, &buffer);
+    for (i = 0; i < chain->n; i++) {
+        t_stage *stage = &chain->stage[i];
+        t_mbuf *next = &out;
+        if (i < chain->n-1) {
+            next = &stage->out;
+            next->L = L;
+            next->n = 0;
+        }
+        if (size > 0) chain_stage(stage, input, size, next);
+        if (end) chain_flush(stage, next);
+        if (next != &out) {
+            input = (const UC *) (next->data? next->data: "");
+            size = next->n;
+        }
+    }
+    luaL_pushresult(&buffer);
+    if (end) {
+        size_t osize = 0;
+        chain->done = 1;
+        lua_tolstring(L, -1, &osize);
+        if (osize == 0) {
+            chain->done = 2;
+            lua_pushnil(L);
+        }
+    }
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Releases the memory of intermediate stages
+\*-------------------------------------------------------------------------*/
+static int chain_meth_gc(lua_State *L)
+{
+    t_chain *chain = (t_chain *) luaL_checkudata(L, 1, MIME_CHAIN);
+    int i;
+    for (i = 0; i < MIME_MAXSTAGES; i++) {
+        free(chain->stage[i].marker);
+        free(chain->stage[i].out.data);
+        chain->stage[i].marker = NULL;
+        chain->stage[i].out.data = NULL;
+    }
+    chain->n = 0;
+    return 0;
+}
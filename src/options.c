@@ -3,6 +3,7 @@
 * LuaSocket toolkit
 \*=========================================================================*/
 #include <string.h>
+#include <limits.h>
 
 #include "lauxlib.h"
 
@@ -10,6 +11,39 @@
 #include "options.h"
 #include "inet.h"
 
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+#include <linux/filter.h>
+#endif
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
+
+#if defined(__linux__) && defined(TCP_INFO)
+#include <stddef.h>
+#include <stdint.h>
+
+/* struct tcp_info as defined by the kernel. The copy in the libc headers
+ * stops at total_retrans, but the kernel only ever appends fields and
+ * reports how many bytes it filled, so we can safely ask for more */
+typedef struct t_tcpinfo_ {
+    uint8_t state, ca_state, retransmits, probes, backoff, options;
+    uint8_t wscale, flags;
+    uint32_t rto, ato, snd_mss, rcv_mss;
+    uint32_t unacked, sacked, lost, retrans, fackets;
+    uint32_t last_data_sent, last_ack_sent, last_data_recv, last_ack_recv;
+    uint32_t pmtu, rcv_ssthresh, rtt, rttvar, snd_ssthresh, snd_cwnd;
+    uint32_t advmss, reordering, rcv_rtt, rcv_space, total_retrans;
+    uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+    uint32_t segs_out, segs_in;
+    uint32_t notsent_bytes, min_rtt, data_segs_in, data_segs_out;
+    uint64_t delivery_rate;
+    uint64_t busy_time, rwnd_limited, sndbuf_limited;
+    uint32_t delivered, delivered_ce;
+    uint64_t bytes_sent, bytes_retrans;
+    uint32_t dsack_dups, reord_seen;
+} t_tcpinfo;
+#endif
 
 /*=========================================================================*\
 * Internal functions prototypes
@@ -20,6 +54,7 @@ static int opt_setboolean(lua_State *L, p_socket ps, int level, int name);
 static int opt_getboolean(lua_State *L, p_socket ps, int level, int name);
 static int opt_setint(lua_State *L, p_socket ps, int level, int name);
 static int opt_getint(lua_State *L, p_socket ps, int level, int name);
+static int opt_setnonneg(lua_State *L, p_socket ps, int level, int name);
 static int opt_set(lua_State *L, p_socket ps, int level, int name,
         void *val, int len);
 static int opt_get(lua_State *L, p_socket ps, int level, int name,
@@ -79,6 +114,121 @@ int opt_get_reuseport(lua_State *L, p_socket ps)
     return opt_getboolean(L, ps, SOL_SOCKET, SO_REUSEPORT);
 }
 
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/* steers incoming connections to the SO_REUSEPORT group member whose
+ * index matches the cpu that handled the packet */
+int opt_set_reuseport_cpu(lua_State *L, p_socket ps)
+{
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog;
+    if (!auxiliar_checkboolean(L, 3)) {           /* obj, name, bool */
+#ifdef SO_DETACH_REUSEPORT_BPF
+        int dummy = 0;
+        return opt_set(L, ps, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+            (char *) &dummy, sizeof(dummy));
+#else
+        lua_pushnil(L);
+        lua_pushstring(L, "setsockopt failed");
+        return 2;
+#endif
+    }
+    prog.len = sizeof(code)/sizeof(code[0]);
+    prog.filter = code;
+    return opt_set(L, ps, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+        (char *) &prog, sizeof(prog));
+}
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+/* wakes up the listener only when data arrives on the new connection */
+int opt_set_tcp_defer_accept(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+}
+
+int opt_get_tcp_defer_accept(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+}
+#endif
+
+#if defined(__linux__) && defined(TCP_INFO)
+/* pushes field if the kernel filled it in */
+#define TCPINFO_FIELD(f) \
+    if ((size_t) len >= offsetof(t_tcpinfo, f) + sizeof(info.f)) { \
+        lua_pushnumber(L, (lua_Number) info.f); \
+        lua_setfield(L, -2, #f); \
+    }
+
+/* returns connection statistics kept by the kernel as a table */
+int opt_get_tcp_info(lua_State *L, p_socket ps)
+{
+    t_tcpinfo info;
+    int len = sizeof(info);
+    int err;
+    memset(&info, 0, sizeof(info));
+    err = opt_get(L, ps, IPPROTO_TCP, TCP_INFO, (char *) &info, &len);
+    if (err)
+        return err;
+    lua_newtable(L);
+    TCPINFO_FIELD(state);
+    TCPINFO_FIELD(ca_state);
+    TCPINFO_FIELD(retransmits);
+    TCPINFO_FIELD(probes);
+    TCPINFO_FIELD(backoff);
+    TCPINFO_FIELD(options);
+    TCPINFO_FIELD(rto);
+    TCPINFO_FIELD(ato);
+    TCPINFO_FIELD(snd_mss);
+    TCPINFO_FIELD(rcv_mss);
+    TCPINFO_FIELD(unacked);
+    TCPINFO_FIELD(sacked);
+    TCPINFO_FIELD(lost);
+    TCPINFO_FIELD(retrans);
+    TCPINFO_FIELD(fackets);
+    TCPINFO_FIELD(last_data_sent);
+    TCPINFO_FIELD(last_ack_sent);
+    TCPINFO_FIELD(last_data_recv);
+    TCPINFO_FIELD(last_ack_recv);
+    TCPINFO_FIELD(pmtu);
+    TCPINFO_FIELD(rcv_ssthresh);
+    TCPINFO_FIELD(rtt);
+    TCPINFO_FIELD(rttvar);
+    TCPINFO_FIELD(snd_ssthresh);
+    TCPINFO_FIELD(snd_cwnd);
+    TCPINFO_FIELD(advmss);
+    TCPINFO_FIELD(reordering);
+    TCPINFO_FIELD(rcv_rtt);
+    TCPINFO_FIELD(rcv_space);
+    TCPINFO_FIELD(total_retrans);
+    TCPINFO_FIELD(pacing_rate);
+    TCPINFO_FIELD(max_pacing_rate);
+    TCPINFO_FIELD(bytes_acked);
+    TCPINFO_FIELD(bytes_received);
+    TCPINFO_FIELD(segs_out);
+    TCPINFO_FIELD(segs_in);
+    TCPINFO_FIELD(notsent_bytes);
+    TCPINFO_FIELD(min_rtt);
+    TCPINFO_FIELD(data_segs_in);
+    TCPINFO_FIELD(data_segs_out);
+    TCPINFO_FIELD(delivery_rate);
+    TCPINFO_FIELD(busy_time);
+    TCPINFO_FIELD(rwnd_limited);
+    TCPINFO_FIELD(sndbuf_limited);
+    TCPINFO_FIELD(delivered);
+    TCPINFO_FIELD(delivered_ce);
+    TCPINFO_FIELD(bytes_sent);
+    TCPINFO_FIELD(bytes_retrans);
+    TCPINFO_FIELD(dsack_dups);
+    TCPINFO_FIELD(reord_seen);
+    return 1;
+}
+#undef TCPINFO_FIELD
+#endif
+
 /* disables the Naggle algorithm */
 int opt_set_tcp_nodelay(lua_State *L, p_socket ps)
 {
@@ -100,6 +250,178 @@ int opt_get_keepalive(lua_State *L, p_socket ps)
     return opt_getboolean(L, ps, SOL_SOCKET, SO_KEEPALIVE);
 }
 
+/* kernel send and receive buffer sizes */
+int opt_set_rcvbuf(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_RCVBUF);
+}
+
+int opt_get_rcvbuf(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_RCVBUF);
+}
+
+int opt_set_sndbuf(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_SNDBUF);
+}
+
+int opt_get_sndbuf(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_SNDBUF);
+}
+
+#ifdef SO_BUSY_POLL
+/* microseconds to busy poll the device queue on blocking reads */
+int opt_set_busy_poll(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_BUSY_POLL);
+}
+
+int opt_get_busy_poll(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_BUSY_POLL);
+}
+#endif
+
+#ifdef SO_INCOMING_CPU
+int opt_set_incoming_cpu(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_INCOMING_CPU);
+}
+
+int opt_get_incoming_cpu(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_INCOMING_CPU);
+}
+#endif
+
+#ifdef SO_PRIORITY
+int opt_set_priority(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_PRIORITY);
+}
+
+int opt_get_priority(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_PRIORITY);
+}
+#endif
+
+#ifdef TCP_NOTSENT_LOWAT
+/* limits unsent data queued in the kernel, to keep latency down */
+int opt_set_tcp_notsent_lowat(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+}
+
+int opt_get_tcp_notsent_lowat(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+}
+#endif
+
+#ifdef TCP_QUICKACK
+int opt_set_tcp_quickack(lua_State *L, p_socket ps)
+{
+    return opt_setboolean(L, ps, IPPROTO_TCP, TCP_QUICKACK);
+}
+
+int opt_get_tcp_quickack(lua_State *L, p_socket ps)
+{
+    return opt_getboolean(L, ps, IPPROTO_TCP, TCP_QUICKACK);
+}
+#endif
+
+/* keepalive probe timing */
+#ifdef TCP_KEEPIDLE
+int opt_set_tcp_keepidle(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_TCP, TCP_KEEPIDLE);
+}
+
+int opt_get_tcp_keepidle(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPIDLE);
+}
+#endif
+
+#ifdef TCP_KEEPINTVL
+int opt_set_tcp_keepintvl(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_TCP, TCP_KEEPINTVL);
+}
+
+int opt_get_tcp_keepintvl(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPINTVL);
+}
+#endif
+
+#ifdef TCP_KEEPCNT
+int opt_set_tcp_keepcnt(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_TCP, TCP_KEEPCNT);
+}
+
+int opt_get_tcp_keepcnt(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPCNT);
+}
+#endif
+
+/* kernel arrival timestamps, reported along with received data */
+#ifdef SO_TIMESTAMPNS
+int opt_set_timestamp(lua_State *L, p_socket ps)
+{
+    return opt_setboolean(L, ps, SOL_SOCKET, SO_TIMESTAMPNS);
+}
+
+int opt_get_timestamp(lua_State *L, p_socket ps)
+{
+    return opt_getboolean(L, ps, SOL_SOCKET, SO_TIMESTAMPNS);
+}
+#endif
+
+/* SOF_TIMESTAMPING_* flags, for software or hardware receive stamps */
+#ifdef SO_TIMESTAMPING
+int opt_set_timestamping(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, SOL_SOCKET, SO_TIMESTAMPING);
+}
+
+int opt_get_timestamping(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_TIMESTAMPING);
+}
+#endif
+
+/* UDP segmentation offload: sends are split into datagrams of this size */
+#ifdef UDP_SEGMENT
+int opt_set_udp_segment(lua_State *L, p_socket ps)
+{
+    return opt_setnonneg(L, ps, IPPROTO_UDP, UDP_SEGMENT);
+}
+
+int opt_get_udp_segment(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_UDP, UDP_SEGMENT);
+}
+#endif
+
+/* UDP receive offload: consecutive datagrams may be coalesced */
+#ifdef UDP_GRO
+int opt_set_udp_gro(lua_State *L, p_socket ps)
+{
+    return opt_setboolean(L, ps, IPPROTO_UDP, UDP_GRO);
+}
+
+int opt_get_udp_gro(lua_State *L, p_socket ps)
+{
+    return opt_getboolean(L, ps, IPPROTO_UDP, UDP_GRO);
+}
+#endif
+
 int opt_set_dontroute(lua_State *L, p_socket ps)
 {
     return opt_setboolean(L, ps, SOL_SOCKET, SO_DONTROUTE);
@@ -372,3 +694,16 @@ static int opt_setint(lua_State *L, p_socket ps, int level, int name)
     int val = (int) lua_tonumber(L, 3);             /* obj, name, int */
     return opt_set(L, ps, level, name, (char *) &val, sizeof(val));
 }
+
+static int opt_setnonneg(lua_State *L, p_socket ps, int level, int name)
+{
+    lua_Number n = luaL_checknumber(L, 3);          /* obj, name, int */
+    int val;
+    /* NaN fails both comparisons, so it never reaches the cast */
+    luaL_argcheck(L, n >= 0 && n <= INT_MAX, 3,
+        "non-negative integer expected");
+    val = (int) n;
+    luaL_argcheck(L, (lua_Number) val == n, 3,
+        "non-negative integer expected");
+    return opt_set(L, ps, level, name, (char *) &val, sizeof(val));
+}
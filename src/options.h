@@ -26,6 +26,8 @@ int opt_set_keepalive(lua_State *L, p_socket ps);
 int opt_set_linger(lua_State *L, p_socket ps);
 int opt_set_reuseaddr(lua_State *L, p_socket ps);
 int opt_set_reuseport(lua_State *L, p_socket ps);
+int opt_set_reuseport_cpu(lua_State *L, p_socket ps);
+int opt_set_tcp_defer_accept(lua_State *L, p_socket ps);
 int opt_set_ip_multicast_if(lua_State *L, p_socket ps);
 int opt_set_ip_multicast_ttl(lua_State *L, p_socket ps);
 int opt_set_ip_multicast_loop(lua_State *L, p_socket ps);
@@ -37,6 +39,20 @@ int opt_set_ip6_multicast_loop(lua_State *L, p_socket ps);
 int opt_set_ip6_add_membership(lua_State *L, p_socket ps);
 int opt_set_ip6_drop_membersip(lua_State *L, p_socket ps);
 int opt_set_ip6_v6only(lua_State *L, p_socket ps);
+int opt_set_rcvbuf(lua_State *L, p_socket ps);
+int opt_set_sndbuf(lua_State *L, p_socket ps);
+int opt_set_busy_poll(lua_State *L, p_socket ps);
+int opt_set_incoming_cpu(lua_State *L, p_socket ps);
+int opt_set_priority(lua_State *L, p_socket ps);
+int opt_set_tcp_notsent_lowat(lua_State *L, p_socket ps);
+int opt_set_tcp_quickack(lua_State *L, p_socket ps);
+int opt_set_tcp_keepidle(lua_State *L, p_socket ps);
+int opt_set_tcp_keepintvl(lua_State *L, p_socket ps);
+int opt_set_tcp_keepcnt(lua_State *L, p_socket ps);
+int opt_set_timestamp(lua_State *L, p_socket ps);
+int opt_set_timestamping(lua_State *L, p_socket ps);
+int opt_set_udp_segment(lua_State *L, p_socket ps);
+int opt_set_udp_gro(lua_State *L, p_socket ps);
 
 /* supported options for getoption */
 int opt_get_dontroute(lua_State *L, p_socket ps);
@@ -44,6 +60,7 @@ int opt_get_broadcast(lua_State *L, p_socket ps);
 int opt_get_reuseaddr(lua_State *L, p_socket ps);
 int opt_get_reuseport(lua_State *L, p_socket ps);
 int opt_get_tcp_nodelay(lua_State *L, p_socket ps);
+int opt_get_tcp_defer_accept(lua_State *L, p_socket ps);
 int opt_get_keepalive(lua_State *L, p_socket ps);
 int opt_get_linger(lua_State *L, p_socket ps);
 int opt_get_ip_multicast_loop(lua_State *L, p_socket ps);
@@ -53,6 +70,21 @@ int opt_get_ip6_multicast_loop(lua_State *L, p_socket ps);
 int opt_get_ip6_multicast_hops(lua_State *L, p_socket ps);
 int opt_get_ip6_unicast_hops(lua_State *L, p_socket ps);
 int opt_get_ip6_v6only(lua_State *L, p_socket ps);
+int opt_get_rcvbuf(lua_State *L, p_socket ps);
+int opt_get_sndbuf(lua_State *L, p_socket ps);
+int opt_get_busy_poll(lua_State *L, p_socket ps);
+int opt_get_incoming_cpu(lua_State *L, p_socket ps);
+int opt_get_priority(lua_State *L, p_socket ps);
+int opt_get_tcp_notsent_lowat(lua_State *L, p_socket ps);
+int opt_get_tcp_quickack(lua_State *L, p_socket ps);
+int opt_get_tcp_keepidle(lua_State *L, p_socket ps);
+int opt_get_tcp_keepintvl(lua_State *L, p_socket ps);
+int opt_get_tcp_keepcnt(lua_State *L, p_socket ps);
+int opt_get_tcp_info(lua_State *L, p_socket ps);
+int opt_get_timestamp(lua_State *L, p_socket ps);
+int opt_get_timestamping(lua_State *L, p_socket ps);
+int opt_get_udp_segment(lua_State *L, p_socket ps);
+int opt_get_udp_gro(lua_State *L, p_socket ps);
 int opt_get_reuseport(lua_State *L, p_socket ps);
 
 /* invokes the appropriate option handler */
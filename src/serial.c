@@ -12,6 +12,11 @@
 #include "options.h"
 #include "unix.h"
 #include <sys/un.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 /*
 Reuses userdata definition from unix.h, since it is useful for all
@@ -30,11 +35,15 @@ have only one object type.
 static int global_create(lua_State *L);
 static int meth_send(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_receivesome(lua_State *L);
+static int meth_setmode(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
 static int meth_setfd(lua_State *L);
 static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
 static int meth_getstats(lua_State *L);
 static int meth_setstats(lua_State *L);
 
@@ -42,14 +51,18 @@ static int meth_setstats(lua_State *L);
 static luaL_Reg serial_methods[] = {
     {"__gc",        meth_close},
     {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
     {"close",       meth_close},
     {"dirty",       meth_dirty},
     {"getfd",       meth_getfd},
     {"getstats",    meth_getstats},
     {"setstats",    meth_setstats},
     {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
+    {"receivesome", meth_receivesome},
     {"send",        meth_send},
     {"setfd",       meth_setfd},
+    {"setmode",     meth_setmode},
     {"settimeout",  meth_settimeout},
     {NULL,          NULL}
 };
@@ -62,6 +75,7 @@ LUASOCKET_API int luaopen_socket_serial(lua_State *L) {
     auxiliar_newclass(L, "serial{client}", serial_methods);
     /* create class groups */
     auxiliar_add2group(L, "serial{client}", "serial{any}");
+    buffer_addreaders(L, "serial{client}");
     lua_pushcfunction(L, global_create);
     return 1;
 }
@@ -82,6 +96,16 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &un->buf);
 }
 
+static int meth_receiveinto(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "serial{client}", 1);
+    return buffer_meth_receiveinto(L, &un->buf);
+}
+
+static int meth_receivesome(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "serial{client}", 1);
+    return buffer_meth_receivesome(L, &un->buf);
+}
+
 static int meth_getstats(lua_State *L) {
     p_unix un = (p_unix) auxiliar_checkclass(L, "serial{client}", 1);
     return buffer_meth_getstats(L, &un->buf);
@@ -92,6 +116,151 @@ static int meth_setstats(lua_State *L) {
     return buffer_meth_setstats(L, &un->buf);
 }
 
+/*-------------------------------------------------------------------------*\
+* Line settings
+\*-------------------------------------------------------------------------*/
+typedef struct t_baud_ {
+    long rate;
+    speed_t speed;
+} t_baud;
+
+static t_baud bauds[] = {
+    {50, B50}, {75, B75}, {110, B110}, {134, B134}, {150, B150},
+    {200, B200}, {300, B300}, {600, B600}, {1200, B1200}, {1800, B1800},
+    {2400, B2400}, {4800, B4800}, {9600, B9600}, {19200, B19200},
+    {38400, B38400},
+#ifdef B57600
+    {57600, B57600},
+#endif
+#ifdef B115200
+    {115200, B115200},
+#endif
+#ifdef B230400
+    {230400, B230400},
+#endif
+#ifdef B460800
+    {460800, B460800},
+#endif
+#ifdef B500000
+    {500000, B500000},
+#endif
+#ifdef B576000
+    {576000, B576000},
+#endif
+#ifdef B921600
+    {921600, B921600},
+#endif
+#ifdef B1000000
+    {1000000, B1000000},
+#endif
+#ifdef B1500000
+    {1500000, B1500000},
+#endif
+#ifdef B2000000
+    {2000000, B2000000},
+#endif
+#ifdef B3000000
+    {3000000, B3000000},
+#endif
+#ifdef B4000000
+    {4000000, B4000000},
+#endif
+    {0, B0}
+};
+
+/* reads an optional control character value from the mode table */
+static int serial_getcc(lua_State *L, const char *name, cc_t *cc) {
+    int set = 0;
+    lua_getfield(L, 2, name);
+    if (!lua_isnil(L, -1)) {
+        lua_Number n = lua_tonumber(L, -1);
+        if (!lua_isnumber(L, -1) || n < 0 || n > 255)
+            luaL_argerror(L, 2, lua_pushfstring(L, "invalid %s", name));
+        *cc = (cc_t) n;
+        set = 1;
+    }
+    lua_pop(L, 1);
+    return set;
+}
+
+/*-------------------------------------------------------------------------*\
+* Changes the termios settings named in the table: baud, raw, vmin and
+* vtime (in tenths of a second). On Linux, with vtime zero, the device
+* only polls readable once vmin bytes are waiting, so receives wake up
+* once per batch. lowlatency asks the driver not to hold back received
+* bytes, where it knows how
+\*-------------------------------------------------------------------------*/
+static int meth_setmode(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "serial{client}", 1);
+    struct termios tio;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (tcgetattr(un->sock, &tio) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    lua_getfield(L, 2, "baud");
+    if (!lua_isnil(L, -1)) {
+        long rate;
+        t_baud *b = bauds;
+        if (!lua_isnumber(L, -1)) luaL_argerror(L, 2, "baud must be a number");
+        rate = (long) lua_tonumber(L, -1);
+        while (b->rate && b->rate != rate) b++;
+        if (!b->rate) luaL_argerror(L, 2, "unsupported baud rate");
+        cfsetispeed(&tio, b->speed);
+        cfsetospeed(&tio, b->speed);
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, 2, "raw");
+    if (!lua_isnil(L, -1)) {
+        if (lua_toboolean(L, -1)) {
+            /* same as cfmakeraw, which is not in POSIX */
+            tio.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL|IXON);
+            tio.c_oflag &= ~OPOST;
+            tio.c_lflag &= ~(ECHO|ECHONL|ICANON|ISIG|IEXTEN);
+            tio.c_cflag &= ~(CSIZE|PARENB);
+            tio.c_cflag |= CS8;
+        } else {
+            tio.c_iflag |= ICRNL|IXON;
+            tio.c_oflag |= OPOST;
+            tio.c_lflag |= ECHO|ICANON|ISIG|IEXTEN;
+        }
+    }
+    lua_pop(L, 1);
+    serial_getcc(L, "vmin", &tio.c_cc[VMIN]);
+    serial_getcc(L, "vtime", &tio.c_cc[VTIME]);
+    if (tcsetattr(un->sock, TCSANOW, &tio) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    lua_getfield(L, 2, "lowlatency");
+    if (!lua_isnil(L, -1)) {
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+        struct serial_struct ss;
+        if (ioctl(un->sock, TIOCGSERIAL, &ss) < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, socket_strerror(errno));
+            return 2;
+        }
+        if (lua_toboolean(L, -1)) ss.flags |= ASYNC_LOW_LATENCY;
+        else ss.flags &= ~ASYNC_LOW_LATENCY;
+        if (ioctl(un->sock, TIOCSSERIAL, &ss) < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, socket_strerror(errno));
+            return 2;
+        }
+#else
+        lua_pushnil(L);
+        lua_pushliteral(L, "lowlatency not supported");
+        return 2;
+#endif
+    }
+    lua_pop(L, 1);
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Select support methods
 \*-------------------------------------------------------------------------*/
@@ -114,6 +283,16 @@ static int meth_dirty(lua_State *L) {
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_getclassudata(L, "serial{client}", 1);
+    if (un) lua_pushlightuserdata(L, &un->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Closes socket used by object
 \*-------------------------------------------------------------------------*/
@@ -31,6 +31,25 @@
 /* we are lazy... */
 typedef struct sockaddr SA;
 
+/* datagrams moved per batched call */
+#define SOCKET_BATCHSIZE 64
+
+/* one datagram in a batched send or receive */
+typedef struct t_dgram_ {
+    char *data;             /* payload */
+    size_t count;           /* buffer size on input, bytes moved on output */
+    SA *addr;               /* peer address or NULL */
+    socklen_t addr_len;     /* address buffer size, actual size on receive */
+} t_dgram;
+typedef t_dgram *p_dgram;
+
+/* what the kernel tells about a received packet besides its contents */
+typedef struct t_rcvinfo_ {
+    size_t segsize;         /* UDP GRO segment size, 0 if not coalesced */
+    double stamp;           /* arrival time in seconds, -1 if unknown */
+} t_rcvinfo;
+typedef t_rcvinfo *p_rcvinfo;
+
 /*=========================================================================*\
 * Functions bellow implement a comfortable platform independent 
 * interface to sockets
@@ -43,6 +62,10 @@ int socket_sendto(p_socket ps, const char *data, size_t count,
         size_t *sent, SA *addr, socklen_t addr_len, p_timeout tm);
 int socket_recvfrom(p_socket ps, char *data, size_t count, 
         size_t *got, SA *addr, socklen_t *addr_len, p_timeout tm);
+int socket_sendmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *sent, p_timeout tm);
+int socket_recvmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *got, p_timeout tm);
 
 void socket_setnonblocking(p_socket ps);
 void socket_setblocking(p_socket ps);
@@ -67,6 +90,8 @@ const char *socket_strerror(int err);
 int socket_send(p_socket ps, const char *data, size_t count, 
         size_t *sent, p_timeout tm);
 int socket_recv(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm);
+int socket_recvinfo(p_socket ps, char *data, size_t count, size_t *got,
+        SA *addr, socklen_t *addr_len, p_rcvinfo info, p_timeout tm);
 int socket_write(p_socket ps, const char *data, size_t count, 
         size_t *sent, p_timeout tm);
 int socket_read(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm);
@@ -75,4 +100,14 @@ const char *socket_ioerror(p_socket ps, int err);
 int socket_gethostbyaddr(const char *addr, socklen_t len, struct hostent **hp);
 int socket_gethostbyname(const char *addr, struct hostent **hp);
 
+#ifndef _WIN32
+/* descriptor passing over local domain sockets, at most SOCKET_MAXFDS
+ * per call (the Linux limit per message) */
+#define SOCKET_MAXFDS 253
+int socket_sendfds(p_socket ps, const char *data, size_t count,
+        size_t *sent, const int *fds, int nfds, p_timeout tm);
+int socket_recvfds(p_socket ps, char *data, size_t count, size_t *got,
+        int *fds, int *nfds, p_timeout tm);
+#endif
+
 #endif /* SOCKET_H */
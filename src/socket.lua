@@ -53,6 +53,88 @@ function _M.bind(host, port, backlog)
     return nil, err
 end
 
+-- creates n listeners on one address, closing them all on failure
+local function openshards(alt, port, n, opts)
+    local shards = {}
+    local function fail(err)
+        for _, s in base.ipairs(shards) do s:close() end
+        return nil, err
+    end
+    for i = 1, n do
+        local sock, res, err
+        if alt.family == "inet" then sock, err = socket.tcp4()
+        else sock, err = socket.tcp6() end
+        if not sock then return fail(err) end
+        shards[i] = sock
+        sock:setoption("reuseaddr", true)
+        res, err = sock:setoption("reuseport", true)
+        if res then res, err = sock:bind(alt.addr, port) end
+        if res then res, err = sock:listen(opts.backlog) end
+        if not res then return fail(err) end
+        -- connections are only accepted once the client has sent data.
+        -- this is best effort, unless the caller asked for it
+        if opts.defer ~= false then
+            local defer, ok = opts.defer
+            if defer == nil or defer == true then defer = 1 end
+            ok, res, err = base.pcall(sock.setoption, sock,
+                "tcp-defer-accept", defer)
+            if not ok then err = res res = nil end
+            if not res and opts.defer ~= nil then return fail(err) end
+        end
+    end
+    -- the program applies to the whole group, so one socket is enough
+    if opts.cpu then
+        local ok, res, err
+        ok, res, err = base.pcall(shards[1].setoption, shards[1],
+            "reuseport-cpu", true)
+        if not ok then err = res res = nil end
+        if not res then return fail(err) end
+    end
+    return shards
+end
+
+-- creates n listeners sharing the same address through SO_REUSEPORT, so
+-- that the kernel balances incoming connections among them. if opts.fork
+-- and opts.worker are given, each listener is handed to its own child
+-- process, which runs opts.worker(server, i) and exits
+function _M.listenshards(host, port, n, opts)
+    opts = opts or {}
+    if host == "*" then host = "0.0.0.0" end
+    local addrinfo, err = socket.dns.getaddrinfo(host)
+    if not addrinfo then return nil, err end
+    local shards
+    err = "no info on address"
+    for _, alt in base.ipairs(addrinfo) do
+        shards, err = openshards(alt, port, n, opts)
+        if shards then break end
+    end
+    if not shards then return nil, err end
+    if not (opts.fork and opts.worker) then return shards end
+    local function closeall()
+        for _, s in base.ipairs(shards) do s:close() end
+    end
+    local pids = {}
+    for i, sock in base.ipairs(shards) do
+        local pid
+        pid, err = opts.fork()
+        if not pid then closeall() return nil, err, pids end
+        if pid == 0 then
+            for j, other in base.ipairs(shards) do
+                if j ~= i then other:close() end
+            end
+            local ok, msg = base.pcall(opts.worker, sock, i)
+            if not ok then
+                base.io.stderr:write("worker ", i, ": ",
+                    base.tostring(msg), "\n")
+            end
+            base.os.exit(ok and 0 or 1)
+        end
+        pids[i] = pid
+    end
+    closeall()
+    return pids
+end
+
 _M.try = _M.newtry()
 
 function _M.choose(table)
@@ -75,9 +157,37 @@ _M.sourcet = sourcet
 _M.sinkt = sinkt
 
 _M.BLOCKSIZE = 2048
+-- sources start with BLOCKSIZE chunks and double them up to MAXBLOCKSIZE
+-- while full chunks keep arriving at least as fast as before
+_M.MAXBLOCKSIZE = 65536
+
+-- sources and sinks keep their socket in 'sock', and by-length sources
+-- what is left to read in 'length', so that ltn12.pump.fast can move the
+-- data without calling them
+
+-- returns a function that gives the size of the next chunk a source
+-- should read. called with the size of the last chunk and how long it
+-- took, it first adapts: a short or much slower chunk halves the size
+local function blocksizer()
+    local size, rate = socket.BLOCKSIZE, 0
+    return function(got, elapsed)
+        if got then
+            local now = got / math.max(elapsed, 1e-6)
+            if got < size or now < rate/2 then
+                size = math.max(math.floor(size/2), socket.BLOCKSIZE)
+            elseif now >= rate then
+                size = math.max(math.min(2*size, socket.MAXBLOCKSIZE),
+                    socket.BLOCKSIZE)
+            end
+            rate = now
+        end
+        return size
+    end
+end
 
 sinkt["close-when-done"] = function(sock)
     return base.setmetatable({
+        sock = sock,
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
@@ -92,6 +202,7 @@ end
 
 sinkt["keep-open"] = function(sock)
     return base.setmetatable({
+        sock = sock,
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
@@ -107,16 +218,21 @@ sinkt["default"] = sinkt["keep-open"]
 _M.sink = _M.choose(sinkt)
 
 sourcet["by-length"] = function(sock, length)
+    local blocksize = blocksizer()
     return base.setmetatable({
+        sock = sock,
+        length = length,
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
-        __call = function()
-            if length <= 0 then return nil end
-            local size = math.min(socket.BLOCKSIZE, length)
+        __call = function(self)
+            if self.length <= 0 then return nil end
+            local size = math.min(blocksize(), self.length)
+            local start = socket.gettime()
             local chunk, err = sock:receive(size)
             if err then return nil, err end
-            length = length - string.len(chunk)
+            blocksize(string.len(chunk), socket.gettime() - start)
+            self.length = self.length - string.len(chunk)
             return chunk
         end
     })
@@ -124,14 +240,19 @@ end
 
 sourcet["until-closed"] = function(sock)
     local done
+    local blocksize = blocksizer()
     return base.setmetatable({
+        sock = sock,
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
         __call = function()
             if done then return nil end
-            local chunk, err, partial = sock:receive(socket.BLOCKSIZE)
-            if not err then return chunk
+            local start = socket.gettime()
+            local chunk, err, partial = sock:receive(blocksize())
+            if not err then
+                blocksize(string.len(chunk), socket.gettime() - start)
+                return chunk
             elseif err == "closed" then
                 sock:close()
                 done = 1
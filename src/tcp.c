@@ -28,10 +28,12 @@ static int meth_bind(lua_State *L);
 static int meth_send(lua_State *L);
 static int meth_getstats(lua_State *L);
 static int meth_setstats(lua_State *L);
+static int meth_getstamp(lua_State *L);
 static int meth_getsockname(lua_State *L);
 static int meth_getpeername(lua_State *L);
 static int meth_shutdown(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
 static int meth_accept(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_getoption(lua_State *L);
@@ -41,11 +43,13 @@ static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
 static int meth_setfd(lua_State *L);
 static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
 
 /* tcp object methods */
 static luaL_Reg tcp_methods[] = {
     {"__gc",        meth_close},
     {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
     {"accept",      meth_accept},
     {"bind",        meth_bind},
     {"close",       meth_close},
@@ -56,10 +60,12 @@ static luaL_Reg tcp_methods[] = {
     {"getoption",   meth_getoption},
     {"getpeername", meth_getpeername},
     {"getsockname", meth_getsockname},
+    {"getstamp",    meth_getstamp},
     {"getstats",    meth_getstats},
     {"setstats",    meth_setstats},
     {"listen",      meth_listen},
     {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
     {"send",        meth_send},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
@@ -77,8 +83,46 @@ static t_opt optget[] = {
     {"reuseaddr",   opt_get_reuseaddr},
     {"reuseport",   opt_get_reuseport},
     {"tcp-nodelay", opt_get_tcp_nodelay},
+#ifdef TCP_DEFER_ACCEPT
+    {"tcp-defer-accept", opt_get_tcp_defer_accept},
+#endif
     {"linger",      opt_get_linger},
     {"error",       opt_get_error},
+    {"rcvbuf",      opt_get_rcvbuf},
+    {"sndbuf",      opt_get_sndbuf},
+#ifdef SO_BUSY_POLL
+    {"busy-poll",   opt_get_busy_poll},
+#endif
+#ifdef SO_INCOMING_CPU
+    {"incoming-cpu", opt_get_incoming_cpu},
+#endif
+#ifdef SO_PRIORITY
+    {"priority",    opt_get_priority},
+#endif
+#ifdef SO_TIMESTAMPNS
+    {"timestamp",   opt_get_timestamp},
+#endif
+#ifdef SO_TIMESTAMPING
+    {"timestamping", opt_get_timestamping},
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    {"tcp-notsent-lowat", opt_get_tcp_notsent_lowat},
+#endif
+#ifdef TCP_QUICKACK
+    {"tcp-quickack", opt_get_tcp_quickack},
+#endif
+#ifdef TCP_KEEPIDLE
+    {"tcp-keepidle", opt_get_tcp_keepidle},
+#endif
+#ifdef TCP_KEEPINTVL
+    {"tcp-keepintvl", opt_get_tcp_keepintvl},
+#endif
+#ifdef TCP_KEEPCNT
+    {"tcp-keepcnt", opt_get_tcp_keepcnt},
+#endif
+#if defined(__linux__) && defined(TCP_INFO)
+    {"tcp-info",    opt_get_tcp_info},
+#endif
     {NULL,          NULL}
 };
 
@@ -86,9 +130,47 @@ static t_opt optset[] = {
     {"keepalive",   opt_set_keepalive},
     {"reuseaddr",   opt_set_reuseaddr},
     {"reuseport",   opt_set_reuseport},
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    {"reuseport-cpu", opt_set_reuseport_cpu},
+#endif
     {"tcp-nodelay", opt_set_tcp_nodelay},
+#ifdef TCP_DEFER_ACCEPT
+    {"tcp-defer-accept", opt_set_tcp_defer_accept},
+#endif
     {"ipv6-v6only", opt_set_ip6_v6only},
     {"linger",      opt_set_linger},
+    {"rcvbuf",      opt_set_rcvbuf},
+    {"sndbuf",      opt_set_sndbuf},
+#ifdef SO_BUSY_POLL
+    {"busy-poll",   opt_set_busy_poll},
+#endif
+#ifdef SO_INCOMING_CPU
+    {"incoming-cpu", opt_set_incoming_cpu},
+#endif
+#ifdef SO_PRIORITY
+    {"priority",    opt_set_priority},
+#endif
+#ifdef SO_TIMESTAMPNS
+    {"timestamp",   opt_set_timestamp},
+#endif
+#ifdef SO_TIMESTAMPING
+    {"timestamping", opt_set_timestamping},
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    {"tcp-notsent-lowat", opt_set_tcp_notsent_lowat},
+#endif
+#ifdef TCP_QUICKACK
+    {"tcp-quickack", opt_set_tcp_quickack},
+#endif
+#ifdef TCP_KEEPIDLE
+    {"tcp-keepidle", opt_set_tcp_keepidle},
+#endif
+#ifdef TCP_KEEPINTVL
+    {"tcp-keepintvl", opt_set_tcp_keepintvl},
+#endif
+#ifdef TCP_KEEPCNT
+    {"tcp-keepcnt", opt_set_tcp_keepcnt},
+#endif
     {NULL,          NULL}
 };
 
@@ -101,6 +183,29 @@ static luaL_Reg func[] = {
     {NULL, NULL}
 };
 
+/*-------------------------------------------------------------------------*\
+* IO driver used once receive timestamps are enabled. It has the object
+* itself as context, so that reads can record the arrival time
+\*-------------------------------------------------------------------------*/
+static int tcp_send(void *ctx, const char *data, size_t count,
+        size_t *sent, p_timeout tm) {
+    return socket_send(&((p_tcp) ctx)->sock, data, count, sent, tm);
+}
+
+static int tcp_recvstamp(void *ctx, char *data, size_t count, size_t *got,
+        p_timeout tm) {
+    p_tcp tcp = (p_tcp) ctx;
+    t_rcvinfo info;
+    int err = socket_recvinfo(&tcp->sock, data, count, got, NULL, NULL,
+        &info, tm);
+    if (info.stamp > 0) tcp->stamp = info.stamp;
+    return err;
+}
+
+static const char *tcp_ioerror(void *ctx, int err) {
+    return socket_ioerror(&((p_tcp) ctx)->sock, err);
+}
+
 /*-------------------------------------------------------------------------*\
 * Initializes module
 \*-------------------------------------------------------------------------*/
@@ -114,6 +219,8 @@ int tcp_open(lua_State *L)
     auxiliar_add2group(L, "tcp{master}", "tcp{any}");
     auxiliar_add2group(L, "tcp{client}", "tcp{any}");
     auxiliar_add2group(L, "tcp{server}", "tcp{any}");
+    /* connected objects can decode binary fields */
+    buffer_addreaders(L, "tcp{client}");
     /* define library functions */
     luaL_setfuncs(L, func, 0);
     return 0;
@@ -135,6 +242,11 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &tcp->buf);
 }
 
+static int meth_receiveinto(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    return buffer_meth_receiveinto(L, &tcp->buf);
+}
+
 static int meth_getstats(lua_State *L) {
     p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
     return buffer_meth_getstats(L, &tcp->buf);
@@ -145,6 +257,20 @@ static int meth_setstats(lua_State *L) {
     return buffer_meth_setstats(L, &tcp->buf);
 }
 
+/*-------------------------------------------------------------------------*\
+* Returns the kernel arrival time of the last data read from the socket
+\*-------------------------------------------------------------------------*/
+static int meth_getstamp(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    if (tcp->stamp <= 0) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "no timestamp");
+        return 2;
+    }
+    lua_pushnumber(L, tcp->stamp);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Just call option handler
 \*-------------------------------------------------------------------------*/
@@ -157,7 +283,13 @@ static int meth_getoption(lua_State *L)
 static int meth_setoption(lua_State *L)
 {
     p_tcp tcp = (p_tcp) auxiliar_checkgroup(L, "tcp{any}", 1);
-    return opt_meth_setoption(L, optset, &tcp->sock);
+    const char *name = luaL_checkstring(L, 2);
+    int ret = opt_meth_setoption(L, optset, &tcp->sock);
+    /* stamps arrive in control messages, so reads must now use recvmsg */
+    if (!lua_isnil(L, -ret) && (!strcmp(name, "timestamp") ||
+            !strcmp(name, "timestamping")))
+        io_init(&tcp->io, tcp_send, tcp_recvstamp, tcp_ioerror, tcp);
+    return ret;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -185,6 +317,17 @@ static int meth_dirty(lua_State *L)
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L)
+{
+    p_tcp tcp = (p_tcp) auxiliar_getclassudata(L, "tcp{client}", 1);
+    if (tcp) lua_pushlightuserdata(L, &tcp->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Waits for and returns a client object attempting connection to the
 * server object
@@ -108,7 +108,7 @@ end
 
 function metat.__index:source(source, step)
     local sink = socket.sink("keep-open", self.c)
-    local ret, err = ltn12.pump.all(source, sink, step or ltn12.pump.step)
+    local ret, err = ltn12.pump.fast(source, sink, step or ltn12.pump.step)
     return ret, err
 end
 
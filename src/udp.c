@@ -13,6 +13,7 @@
 #include "socket.h"
 #include "inet.h"
 #include "options.h"
+#include "bytes.h"
 #include "udp.h"
 
 /* min and max macros */
@@ -33,6 +34,9 @@ static int meth_send(lua_State *L);
 static int meth_sendto(lua_State *L);
 static int meth_receive(lua_State *L);
 static int meth_receivefrom(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_sendmany(lua_State *L);
+static int meth_receivemany(lua_State *L);
 static int meth_getfamily(lua_State *L);
 static int meth_getsockname(lua_State *L);
 static int meth_getpeername(lua_State *L);
@@ -59,8 +63,11 @@ static luaL_Reg udp_methods[] = {
     {"getsockname", meth_getsockname},
     {"receive",     meth_receive},
     {"receivefrom", meth_receivefrom},
+    {"receiveinto", meth_receiveinto},
+    {"receivemany", meth_receivemany},
     {"send",        meth_send},
     {"sendto",      meth_sendto},
+    {"sendmany",    meth_sendmany},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
     {"getoption",   meth_getoption},
@@ -88,6 +95,29 @@ static t_opt optset[] = {
     {"ipv6-add-membership",  opt_set_ip6_add_membership},
     {"ipv6-drop-membership", opt_set_ip6_drop_membersip},
     {"ipv6-v6only",          opt_set_ip6_v6only},
+    {"rcvbuf",               opt_set_rcvbuf},
+    {"sndbuf",               opt_set_sndbuf},
+#ifdef SO_BUSY_POLL
+    {"busy-poll",            opt_set_busy_poll},
+#endif
+#ifdef SO_INCOMING_CPU
+    {"incoming-cpu",         opt_set_incoming_cpu},
+#endif
+#ifdef SO_PRIORITY
+    {"priority",             opt_set_priority},
+#endif
+#ifdef SO_TIMESTAMPNS
+    {"timestamp",            opt_set_timestamp},
+#endif
+#ifdef SO_TIMESTAMPING
+    {"timestamping",         opt_set_timestamping},
+#endif
+#ifdef UDP_SEGMENT
+    {"udp-segment",          opt_set_udp_segment},
+#endif
+#ifdef UDP_GRO
+    {"udp-gro",              opt_set_udp_gro},
+#endif
     {NULL,                   NULL}
 };
 
@@ -104,6 +134,29 @@ static t_opt optget[] = {
     {"ipv6-multicast-hops",  opt_get_ip6_unicast_hops},
     {"ipv6-multicast-loop",  opt_get_ip6_multicast_loop},
     {"ipv6-v6only",          opt_get_ip6_v6only},
+    {"rcvbuf",               opt_get_rcvbuf},
+    {"sndbuf",               opt_get_sndbuf},
+#ifdef SO_BUSY_POLL
+    {"busy-poll",            opt_get_busy_poll},
+#endif
+#ifdef SO_INCOMING_CPU
+    {"incoming-cpu",         opt_get_incoming_cpu},
+#endif
+#ifdef SO_PRIORITY
+    {"priority",             opt_get_priority},
+#endif
+#ifdef SO_TIMESTAMPNS
+    {"timestamp",            opt_get_timestamp},
+#endif
+#ifdef SO_TIMESTAMPING
+    {"timestamping",         opt_get_timestamping},
+#endif
+#ifdef UDP_SEGMENT
+    {"udp-segment",          opt_get_udp_segment},
+#endif
+#ifdef UDP_GRO
+    {"udp-gro",              opt_get_udp_gro},
+#endif
     {NULL,                   NULL}
 };
 
@@ -146,6 +199,69 @@ static const char *udp_strerror(int err) {
     else return socket_strerror(err);
 }
 
+/*-------------------------------------------------------------------------*\
+* Picks the buffer for a receive of wanted bytes: the UDP_DATAGRAMSIZE
+* stack buffer, if any and large enough, then the rcvsize buffer, and only
+* then the heap
+\*-------------------------------------------------------------------------*/
+static char *udp_getbuf(p_udp udp, char *stack, size_t wanted) {
+    if (stack && wanted <= UDP_DATAGRAMSIZE) return stack;
+    if (wanted <= udp->rcvsize) return udp->rcvbuf;
+    return (char *) malloc(wanted);
+}
+
+static void udp_freebuf(p_udp udp, char *stack, char *dgram) {
+    if (dgram != stack && dgram != udp->rcvbuf) free(dgram);
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes what the kernel reported with a datagram, after the regular
+* results: the GRO segment size, then the arrival time. Trailing values
+* that are unknown are omitted, the others become nil
+\*-------------------------------------------------------------------------*/
+static int udp_pushinfo(lua_State *L, p_rcvinfo info) {
+    if (info->stamp < 0) {
+        if (info->segsize == 0) return 0;
+        lua_pushnumber(L, (lua_Number) info->segsize);
+        return 1;
+    }
+    if (info->segsize > 0) lua_pushnumber(L, (lua_Number) info->segsize);
+    else lua_pushnil(L);
+    lua_pushnumber(L, info->stamp);
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Checks a binary address, as returned by receivefrom in binary mode, and
+* copies it into addr. Creates the socket if this is the first use of an
+* AF_UNSPEC object
+\*-------------------------------------------------------------------------*/
+static const char *udp_rawaddr(p_udp udp, const char *raw, size_t len,
+        struct sockaddr_storage *addr, socklen_t *addr_len) {
+    if (len < sizeof(addr->ss_family) || len > sizeof(*addr))
+        return "invalid address";
+    memcpy(addr, raw, len);
+    switch (addr->ss_family) {
+        case AF_INET:
+            if (len != sizeof(struct sockaddr_in)) return "invalid address";
+            break;
+        case AF_INET6:
+            if (len != sizeof(struct sockaddr_in6)) return "invalid address";
+            break;
+        default:
+            return "invalid address";
+    }
+    if (udp->family == AF_UNSPEC && udp->sock == SOCKET_INVALID) {
+        const char *errstr = inet_trycreate(&udp->sock, addr->ss_family,
+            SOCK_DGRAM, 0);
+        if (errstr) return errstr;
+        socket_setnonblocking(&udp->sock);
+        udp->family = addr->ss_family;
+    }
+    *addr_len = (socklen_t) len;
+    return NULL;
+}
+
 /*-------------------------------------------------------------------------*\
 * Send data through connected udp socket
 \*-------------------------------------------------------------------------*/
@@ -154,7 +270,7 @@ static int meth_send(lua_State *L) {
     p_timeout tm = &udp->tm;
     size_t count, sent = 0;
     int err;
-    const char *data = luaL_checklstring(L, 2, &count);
+    const char *data = bytes_checklstring(L, 2, &count);
     timeout_markstart(tm);
     err = socket_send(&udp->sock, data, count, &sent, tm);
     if (err != IO_DONE) {
@@ -172,13 +288,37 @@ static int meth_send(lua_State *L) {
 static int meth_sendto(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkclass(L, "udp{unconnected}", 1);
     size_t count, sent = 0;
-    const char *data = luaL_checklstring(L, 2, &count);
-    const char *ip = luaL_checkstring(L, 3);
-    const char *port = luaL_checkstring(L, 4);
+    const char *data = bytes_checklstring(L, 2, &count);
+    const char *ip, *port;
     p_timeout tm = &udp->tm;
     int err;
     struct addrinfo aihint;
     struct addrinfo *ai;
+    /* binary addresses are used as they are, no need to resolve them */
+    if (lua_isnoneornil(L, 4)) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        size_t len;
+        const char *raw = luaL_checklstring(L, 3, &len);
+        const char *errstr = udp_rawaddr(udp, raw, len, &addr, &addr_len);
+        if (errstr) {
+            lua_pushnil(L);
+            lua_pushstring(L, errstr);
+            return 2;
+        }
+        timeout_markstart(tm);
+        err = socket_sendto(&udp->sock, data, count, &sent, (SA *) &addr,
+            addr_len, tm);
+        if (err != IO_DONE) {
+            lua_pushnil(L);
+            lua_pushstring(L, udp_strerror(err));
+            return 2;
+        }
+        lua_pushnumber(L, (lua_Number) sent);
+        return 1;
+    }
+    ip = luaL_checkstring(L, 3);
+    port = luaL_checkstring(L, 4);
     memset(&aihint, 0, sizeof(aihint));
     aihint.ai_family = udp->family;
     aihint.ai_socktype = SOCK_DGRAM;
@@ -230,7 +370,8 @@ static int meth_receive(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
     char buf[UDP_DATAGRAMSIZE];
     size_t got, wanted = (size_t) luaL_optnumber(L, 2, sizeof(buf));
-    char *dgram = wanted > sizeof(buf)? (char *) malloc(wanted): buf;
+    char *dgram = udp_getbuf(udp, buf, wanted);
+    t_rcvinfo info;
     int err;
     p_timeout tm = &udp->tm;
     timeout_markstart(tm);
@@ -239,31 +380,35 @@ static int meth_receive(lua_State *L) {
         lua_pushliteral(L, "out of memory");
         return 2;
     }
-    err = socket_recv(&udp->sock, dgram, wanted, &got, tm);
+    err = socket_recvinfo(&udp->sock, dgram, wanted, &got, NULL, NULL,
+        &info, tm);
     /* Unlike TCP, recv() of zero is not closed, but a zero-length packet. */
     if (err != IO_DONE && err != IO_CLOSED) {
         lua_pushnil(L);
         lua_pushstring(L, udp_strerror(err));
-        if (wanted > sizeof(buf)) free(dgram);
+        udp_freebuf(udp, buf, dgram);
         return 2;
     }
     lua_pushlstring(L, dgram, got);
-    if (wanted > sizeof(buf)) free(dgram);
-    return 1;
+    udp_freebuf(udp, buf, dgram);
+    return 1 + udp_pushinfo(L, &info);
 }
 
 /*-------------------------------------------------------------------------*\
 * Receives data and sender from a UDP socket
 \*-------------------------------------------------------------------------*/
 static int meth_receivefrom(lua_State *L) {
+    static const char *modes[] = {"text", "binary", NULL};
     p_udp udp = (p_udp) auxiliar_checkclass(L, "udp{unconnected}", 1);
     char buf[UDP_DATAGRAMSIZE];
     size_t got, wanted = (size_t) luaL_optnumber(L, 2, sizeof(buf));
-    char *dgram = wanted > sizeof(buf)? (char *) malloc(wanted): buf;
+    int binary = luaL_checkoption(L, 3, "text", modes);
+    char *dgram = udp_getbuf(udp, buf, wanted);
     struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
     char addrstr[INET6_ADDRSTRLEN];
     char portstr[6];
+    t_rcvinfo info;
     int err;
     p_timeout tm = &udp->tm;
     timeout_markstart(tm);
@@ -272,27 +417,239 @@ static int meth_receivefrom(lua_State *L) {
         lua_pushliteral(L, "out of memory");
         return 2;
     }
-    err = socket_recvfrom(&udp->sock, dgram, wanted, &got, (SA *) &addr,
-            &addr_len, tm);
+    err = socket_recvinfo(&udp->sock, dgram, wanted, &got, (SA *) &addr,
+            &addr_len, &info, tm);
     /* Unlike TCP, recv() of zero is not closed, but a zero-length packet. */
     if (err != IO_DONE && err != IO_CLOSED) {
         lua_pushnil(L);
         lua_pushstring(L, udp_strerror(err));
-        if (wanted > sizeof(buf)) free(dgram);
+        udp_freebuf(udp, buf, dgram);
         return 2;
     }
+    /* the raw sockaddr bytes, good as a table key and as a sendto target */
+    if (binary) {
+        lua_pushlstring(L, dgram, got);
+        lua_pushlstring(L, (char *) &addr, addr_len);
+        udp_freebuf(udp, buf, dgram);
+        return 2 + udp_pushinfo(L, &info);
+    }
     err = getnameinfo((struct sockaddr *)&addr, addr_len, addrstr,
         INET6_ADDRSTRLEN, portstr, 6, NI_NUMERICHOST | NI_NUMERICSERV);
 	if (err) {
         lua_pushnil(L);
         lua_pushstring(L, gai_strerror(err));
-        if (wanted > sizeof(buf)) free(dgram);
+        udp_freebuf(udp, buf, dgram);
         return 2;
     }
     lua_pushlstring(L, dgram, got);
     lua_pushstring(L, addrstr);
     lua_pushinteger(L, (int) strtol(portstr, (char **) NULL, 10));
-    if (wanted > sizeof(buf)) free(dgram);
+    udp_freebuf(udp, buf, dgram);
+    return 3 + udp_pushinfo(L, &info);
+}
+
+/*-------------------------------------------------------------------------*\
+* Receives a datagram into a byte buffer, returning its size
+\*-------------------------------------------------------------------------*/
+static int meth_receiveinto(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    p_bytes b = bytes_checkwritable(L, 2);
+    size_t got, wanted;
+    size_t offset = bytes_checkrange(L, b, 3, &wanted);
+    t_rcvinfo info;
+    int err;
+    p_timeout tm = &udp->tm;
+    timeout_markstart(tm);
+    err = socket_recvinfo(&udp->sock, b->data + offset, wanted, &got,
+        NULL, NULL, &info, tm);
+    /* Unlike TCP, recv() of zero is not closed, but a zero-length packet. */
+    if (err != IO_DONE && err != IO_CLOSED) {
+        lua_pushnil(L);
+        lua_pushstring(L, udp_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, (lua_Number) got);
+    return 1 + udp_pushinfo(L, &info);
+}
+
+/*-------------------------------------------------------------------------*\
+* Resolves a numeric address into addr, creating the socket if this is the
+* first use of an AF_UNSPEC object
+\*-------------------------------------------------------------------------*/
+static const char *udp_resolve(p_udp udp, const char *ip, const char *port,
+        struct sockaddr_storage *addr, socklen_t *addr_len) {
+    struct addrinfo aihint;
+    struct addrinfo *ai;
+    int err;
+    memset(&aihint, 0, sizeof(aihint));
+    aihint.ai_family = udp->family;
+    aihint.ai_socktype = SOCK_DGRAM;
+    aihint.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    err = getaddrinfo(ip, port, &aihint, &ai);
+    if (err) return gai_strerror(err);
+    if (udp->family == AF_UNSPEC && udp->sock == SOCKET_INVALID) {
+        struct addrinfo *ap;
+        const char *errstr = NULL;
+        for (ap = ai; ap != NULL; ap = ap->ai_next) {
+            errstr = inet_trycreate(&udp->sock, ap->ai_family, SOCK_DGRAM, 0);
+            if (errstr == NULL) {
+                socket_setnonblocking(&udp->sock);
+                udp->family = ap->ai_family;
+                break;
+            }
+        }
+        if (errstr != NULL) {
+            freeaddrinfo(ai);
+            return errstr;
+        }
+    }
+    memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+    *addr_len = (socklen_t) ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Sends an array of datagrams. Entries are strings on connected objects,
+* or {data, ip, port} or {data, address} tables on unconnected ones
+\*-------------------------------------------------------------------------*/
+static int meth_sendmany(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    t_dgram dgrams[SOCKET_BATCHSIZE];
+    struct sockaddr_storage addrs[SOCKET_BATCHSIZE];
+    p_timeout tm = &udp->tm;
+    size_t total = 0;
+    int err = IO_DONE;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    /* the payloads of a batch stay on the stack until it is sent, so
+     * that strings converted from numbers are not collected meanwhile */
+    luaL_checkstack(L, SOCKET_BATCHSIZE + 8, "too many datagrams");
+    timeout_markstart(tm);
+    for ( ;; ) {
+        size_t n = 0, sent = 0;
+        while (n < SOCKET_BATCHSIZE) {
+            p_dgram d = dgrams + n;
+            lua_rawgeti(L, 2, (int) (total + n + 1));
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                break;
+            }
+            d->addr = NULL;
+            d->addr_len = 0;
+            if (lua_istable(L, -1)) {
+                const char *errstr = NULL;
+                lua_rawgeti(L, -1, 1);
+                lua_rawgeti(L, -2, 2);
+                lua_rawgeti(L, -3, 3);
+                if (!lua_isstring(L, -3))
+                    luaL_argerror(L, 2, "string datagram expected");
+                d->data = (char *) lua_tolstring(L, -3, &d->count);
+                if (!lua_isnil(L, -2)) {
+                    if (!lua_isstring(L, -2))
+                        luaL_argerror(L, 2, "address expected");
+                    if (lua_isnil(L, -1)) {
+                        size_t len;
+                        const char *raw = lua_tolstring(L, -2, &len);
+                        errstr = udp_rawaddr(udp, raw, len, addrs + n,
+                            &d->addr_len);
+                    } else if (lua_isstring(L, -1)) {
+                        errstr = udp_resolve(udp, lua_tostring(L, -2),
+                            lua_tostring(L, -1), addrs + n, &d->addr_len);
+                    } else luaL_argerror(L, 2, "address expected");
+                    if (errstr) {
+                        lua_pushnil(L);
+                        lua_pushstring(L, errstr);
+                        lua_pushnumber(L, (lua_Number) total);
+                        return 3;
+                    }
+                    d->addr = (SA *) (addrs + n);
+                }
+                /* keep only the payload */
+                lua_pop(L, 2);
+                lua_remove(L, -2);
+            } else if (lua_isstring(L, -1)) {
+                d->data = (char *) lua_tolstring(L, -1, &d->count);
+            } else luaL_argerror(L, 2, "string or table entries expected");
+            n++;
+        }
+        if (n == 0) break;
+        err = socket_sendmany(&udp->sock, dgrams, n, &sent, tm);
+        lua_pop(L, (int) n);
+        total += sent;
+        if (err != IO_DONE || n < SOCKET_BATCHSIZE) break;
+    }
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, udp_strerror(err));
+        lua_pushnumber(L, (lua_Number) total);
+        return 3;
+    }
+    lua_pushnumber(L, (lua_Number) total);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Receives up to count datagrams in one go. Returns arrays with the
+* datagrams, the sender addresses and the sender ports
+\*-------------------------------------------------------------------------*/
+static int meth_receivemany(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    size_t count = (size_t) luaL_optnumber(L, 2, SOCKET_BATCHSIZE);
+    size_t wanted = (size_t) luaL_optnumber(L, 3, UDP_DATAGRAMSIZE);
+    size_t i, got, each = sizeof(t_dgram) + sizeof(struct sockaddr_storage);
+    p_dgram dgrams;
+    struct sockaddr_storage *addrs;
+    char *data;
+    int err;
+    p_timeout tm = &udp->tm;
+    luaL_argcheck(L, count > 0 && count <= ((size_t) -1)/each, 2,
+        "invalid datagram count");
+    luaL_argcheck(L, wanted <= ((size_t) -1 - count*each)/count, 3,
+        "invalid datagram size");
+    timeout_markstart(tm);
+    dgrams = (p_dgram) udp_getbuf(udp, NULL, count*(each + wanted));
+    if (!dgrams) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "out of memory");
+        return 2;
+    }
+    addrs = (struct sockaddr_storage *) (dgrams + count);
+    data = (char *) (addrs + count);
+    for (i = 0; i < count; i++) {
+        dgrams[i].data = data + i*wanted;
+        dgrams[i].count = wanted;
+        dgrams[i].addr = (SA *) (addrs + i);
+        dgrams[i].addr_len = sizeof(addrs[i]);
+    }
+    err = socket_recvmany(&udp->sock, dgrams, count, &got, tm);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, udp_strerror(err));
+        udp_freebuf(udp, NULL, (char *) dgrams);
+        return 2;
+    }
+    lua_createtable(L, (int) got, 0);
+    lua_createtable(L, (int) got, 0);
+    lua_createtable(L, (int) got, 0);
+    for (i = 0; i < got; i++) {
+        char addrstr[INET6_ADDRSTRLEN];
+        char portstr[6];
+        err = getnameinfo(dgrams[i].addr, dgrams[i].addr_len, addrstr,
+            INET6_ADDRSTRLEN, portstr, 6, NI_NUMERICHOST | NI_NUMERICSERV);
+        if (err) {
+            udp_freebuf(udp, NULL, (char *) dgrams);
+            lua_pushnil(L);
+            lua_pushstring(L, gai_strerror(err));
+            return 2;
+        }
+        lua_pushlstring(L, dgrams[i].data, dgrams[i].count);
+        lua_rawseti(L, -4, (int) i+1);
+        lua_pushstring(L, addrstr);
+        lua_rawseti(L, -3, (int) i+1);
+        lua_pushinteger(L, (int) strtol(portstr, (char **) NULL, 10));
+        lua_rawseti(L, -2, (int) i+1);
+    }
+    udp_freebuf(udp, NULL, (char *) dgrams);
     return 3;
 }
 
@@ -346,11 +703,38 @@ static int meth_getsockname(lua_State *L) {
     return inet_meth_getsockname(L, &udp->sock, udp->family);
 }
 
+/*-------------------------------------------------------------------------*\
+* Replaces the reusable receive buffer. Receives of up to this many bytes
+* then need no allocation. Zero releases the buffer
+\*-------------------------------------------------------------------------*/
+static int udp_setrcvsize(lua_State *L, p_udp udp) {
+    lua_Number n = luaL_checknumber(L, 3);
+    size_t size;
+    char *rcvbuf = NULL;
+    /* no datagram is larger than 64KB, and NaN fails the check */
+    luaL_argcheck(L, n >= 0 && n <= 65536, 3, "invalid receive buffer size");
+    size = (size_t) n;
+    luaL_argcheck(L, (lua_Number) size == n, 3,
+        "non-negative integer expected");
+    if (size > 0 && !(rcvbuf = (char *) malloc(size))) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "out of memory");
+        return 2;
+    }
+    free(udp->rcvbuf);
+    udp->rcvbuf = rcvbuf;
+    udp->rcvsize = size;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Just call option handler
 \*-------------------------------------------------------------------------*/
 static int meth_setoption(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    if (strcmp(luaL_checkstring(L, 2), "rcvsize") == 0)
+        return udp_setrcvsize(L, udp);
     return opt_meth_setoption(L, optset, &udp->sock);
 }
 
@@ -359,6 +743,10 @@ static int meth_setoption(lua_State *L) {
 \*-------------------------------------------------------------------------*/
 static int meth_getoption(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    if (strcmp(luaL_checkstring(L, 2), "rcvsize") == 0) {
+        lua_pushnumber(L, (lua_Number) udp->rcvsize);
+        return 1;
+    }
     return opt_meth_getoption(L, optget, &udp->sock);
 }
 
@@ -415,6 +803,9 @@ static int meth_setpeername(lua_State *L) {
 static int meth_close(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
     socket_destroy(&udp->sock);
+    free(udp->rcvbuf);
+    udp->rcvbuf = NULL;
+    udp->rcvsize = 0;
     lua_pushnumber(L, 1);
     return 1;
 }
@@ -458,6 +849,8 @@ static int udp_create(lua_State *L, int family) {
     udp->sock = SOCKET_INVALID;
     timeout_init(&udp->tm, -1, -1);
     udp->family = family;
+    udp->rcvbuf = NULL;
+    udp->rcvsize = 0;
     if (family != AF_UNSPEC) {
         const char *err = inet_trycreate(&udp->sock, family, SOCK_DGRAM, 0);
         if (err != NULL) {
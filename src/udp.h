@@ -23,6 +23,8 @@ typedef struct t_udp_ {
     t_socket sock;
     t_timeout tm;
     int family;
+    char *rcvbuf;          /* reusable buffer for large receives */
+    size_t rcvsize;        /* size of rcvbuf, set with the rcvsize option */
 } t_udp;
 typedef t_udp *p_udp;
 
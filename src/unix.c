@@ -2,11 +2,21 @@
 * Unix domain socket
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <string.h>
+#include <sys/un.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "auxiliar.h"
+#include "tcp.h"
+#include "udp.h"
 #include "unixstream.h"
 #include "unixdgram.h"
+#include "unixseqpacket.h"
+#include "unixring.h"
+
+#define UNIX_FDDATASIZE 8192
 
 /*-------------------------------------------------------------------------*\
 * Modules and functions
@@ -14,6 +24,8 @@
 static const luaL_Reg mod[] = {
     {"stream", unixstream_open},
     {"dgram", unixdgram_open},
+    {"seqpacket", unixseqpacket_open},
+    {"ring", unixring_open},
     {NULL, NULL}
 };
 
@@ -42,6 +54,191 @@ static int compat_socket_unix_call(lua_State *L)
     return n;
 }
 
+/*-------------------------------------------------------------------------*\
+* Picks the class matching a received descriptor. Returns NULL if it is
+* not a socket we know how to wrap, or if the class is not loaded
+\*-------------------------------------------------------------------------*/
+static const char *unix_fdclass(lua_State *L, int fd, int *family)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int type = 0, listening = 0, connected;
+    const char *classname = NULL;
+    socklen_t optlen = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen) < 0) return NULL;
+#ifdef SO_ACCEPTCONN
+    optlen = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen) < 0)
+        listening = 0;
+#endif
+    if (getsockname(fd, (SA *) &addr, &len) < 0) return NULL;
+    *family = addr.ss_family;
+    len = sizeof(addr);
+    connected = getpeername(fd, (SA *) &addr, &len) == 0;
+    switch (*family) {
+        case AF_UNIX:
+            if (type == SOCK_STREAM) classname = listening?
+                "unixstream{server}": "unixstream{client}";
+            else if (type == SOCK_DGRAM) classname = connected?
+                "unixdgram{connected}": "unixdgram{unconnected}";
+            else if (type == SOCK_SEQPACKET) classname = listening?
+                "unixseqpacket{server}": "unixseqpacket{client}";
+            break;
+        case AF_INET:
+        case AF_INET6:
+            if (type == SOCK_STREAM) classname = listening?
+                "tcp{server}": "tcp{client}";
+            else if (type == SOCK_DGRAM) classname = connected?
+                "udp{connected}": "udp{unconnected}";
+            break;
+    }
+    if (!classname) return NULL;
+    /* tcp and udp classes only exist once socket.core is loaded */
+    luaL_getmetatable(L, classname);
+    if (lua_isnil(L, -1)) classname = NULL;
+    lua_pop(L, 1);
+    return classname;
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes a received descriptor as a tcp, udp or unix object, or as a
+* plain number if it is something else
+\*-------------------------------------------------------------------------*/
+static void unix_pushfd(lua_State *L, int fd)
+{
+    int family = AF_UNSPEC;
+    const char *classname = unix_fdclass(L, fd, &family);
+    t_socket sock = fd;
+    if (!classname) {
+        lua_pushnumber(L, fd);
+        return;
+    }
+    socket_setnonblocking(&sock);
+    if (family == AF_UNIX) {
+        p_unix un = (p_unix) lua_newuserdata(L, sizeof(t_unix));
+        un->sock = sock;
+        io_init(&un->io, (p_send) socket_send, (p_recv) socket_recv,
+                (p_error) socket_ioerror, &un->sock);
+        timeout_init(&un->tm, -1, -1);
+        buffer_init(&un->buf, &un->io, &un->tm);
+    } else if (classname[0] == 't') {
+        p_tcp tcp = (p_tcp) lua_newuserdata(L, sizeof(t_tcp));
+        memset(tcp, 0, sizeof(t_tcp));
+        tcp->sock = sock;
+        tcp->family = family;
+        io_init(&tcp->io, (p_send) socket_send, (p_recv) socket_recv,
+                (p_error) socket_ioerror, &tcp->sock);
+        timeout_init(&tcp->tm, -1, -1);
+        buffer_init(&tcp->buf, &tcp->io, &tcp->tm);
+    } else {
+        p_udp udp = (p_udp) lua_newuserdata(L, sizeof(t_udp));
+        memset(udp, 0, sizeof(t_udp));
+        udp->sock = sock;
+        udp->family = family;
+        timeout_init(&udp->tm, -1, -1);
+    }
+    auxiliar_setclass(L, classname, -1);
+}
+
+/*-------------------------------------------------------------------------*\
+* Sends data along with an array of descriptors. Entries are numbers or
+* objects with a getfd method
+\*-------------------------------------------------------------------------*/
+int unix_meth_sendfds(lua_State *L, p_unix un)
+{
+    int fds[SOCKET_MAXFDS];
+    int nfds = 0, err;
+    size_t count, sent = 0;
+    const char *data = luaL_checklstring(L, 2, &count);
+    p_timeout tm = &un->tm;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    luaL_argcheck(L, count > 0, 2, "data must not be empty");
+    for ( ;; ) {
+        lua_rawgeti(L, 3, nfds + 1);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        luaL_argcheck(L, nfds < SOCKET_MAXFDS, 3, "too many descriptors");
+        if (!lua_isnumber(L, -1)) {
+            lua_getfield(L, -1, "getfd");
+            if (!lua_isfunction(L, -1))
+                luaL_argerror(L, 3, "descriptor or object expected");
+            lua_insert(L, -2);
+            lua_call(L, 1, 1);
+        }
+        fds[nfds] = (int) lua_tonumber(L, -1);
+        luaL_argcheck(L, fds[nfds] >= 0, 3, "invalid descriptor");
+        lua_pop(L, 1);
+        nfds++;
+    }
+    timeout_markstart(tm);
+    err = socket_sendfds(&un->sock, data, count, &sent, fds, nfds, tm);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, (lua_Number) sent);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Receives data along with any passed descriptors, bypassing the buffer.
+* On datagram sockets, an empty read is an empty datagram, not closed.
+* Stream bytes already buffered by receive would be skipped, so the call
+* is refused until they are consumed: don't interleave the two on streams
+\*-------------------------------------------------------------------------*/
+int unix_meth_receivefds(lua_State *L, p_unix un, int dgram)
+{
+    char data[UNIX_FDDATASIZE];
+    int fds[SOCKET_MAXFDS];
+    int i, nfds = 0, err;
+    size_t got = 0;
+    size_t wanted = (size_t) luaL_optnumber(L, 2, sizeof(data));
+    p_timeout tm = &un->tm;
+    luaL_argcheck(L, wanted > 0 && wanted <= sizeof(data), 2,
+        "invalid size");
+    if (!buffer_isempty(&un->buf)) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "buffered data pending");
+        return 2;
+    }
+    timeout_markstart(tm);
+    err = socket_recvfds(&un->sock, data, wanted, &got, fds, &nfds, tm);
+    if (err != IO_DONE && !(dgram && err == IO_CLOSED)) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    lua_pushlstring(L, data, got);
+    lua_createtable(L, nfds, 0);
+    for (i = 0; i < nfds; i++) {
+        unix_pushfd(L, fds[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a pair of connected objects of the given type
+\*-------------------------------------------------------------------------*/
+static int global_pair(lua_State *L)
+{
+    static const char *types[] = {"stream", "dgram", "seqpacket", NULL};
+    static const int typevalue[] = {SOCK_STREAM, SOCK_DGRAM, SOCK_SEQPACKET};
+    int type = typevalue[luaL_checkoption(L, 1, "stream", types)];
+    int sv[2];
+    if (socketpair(AF_UNIX, type, 0, sv) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    unix_pushfd(L, sv[0]);
+    unix_pushfd(L, sv[1]);
+    return 2;
+}
+
 /*-------------------------------------------------------------------------*\
 * Initializes module
 \*-------------------------------------------------------------------------*/
@@ -54,6 +251,10 @@ int luaopen_socket_unix(lua_State *L)
     for (i = 0; mod[i].name; i++)
         mod[i].func(L);
 
+    /* Add the function that creates pairs of connected objects. */
+    lua_pushcfunction(L, global_pair);
+    lua_setfield(L, socket_unix_table, "pair");
+
     /* Add backwards compatibility aliases "tcp" and "udp" for the "stream" and
      * "dgram" functions. */
     add_alias(L, socket_unix_table, "tcp", "stream");
@@ -27,4 +27,7 @@ typedef t_unix *p_unix;
 
 UNIX_API int luaopen_socket_unix(lua_State *L);
 
+int unix_meth_sendfds(lua_State *L, p_unix un);
+int unix_meth_receivefds(lua_State *L, p_unix un, int dgram);
+
 #endif /* UNIX_H */
@@ -10,6 +10,7 @@
 #include "compat.h"
 
 #include "auxiliar.h"
+#include "bytes.h"
 #include "socket.h"
 #include "options.h"
 #include "unix.h"
@@ -25,6 +26,9 @@ static int meth_connect(lua_State *L);
 static int meth_bind(lua_State *L);
 static int meth_send(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_receivefds(lua_State *L);
+static int meth_sendfds(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_setoption(lua_State *L);
 static int meth_settimeout(lua_State *L);
@@ -49,9 +53,12 @@ static luaL_Reg unixdgram_methods[] = {
     {"dirty",       meth_dirty},
     {"getfd",       meth_getfd},
     {"send",        meth_send},
+    {"sendfds",     meth_sendfds},
     {"sendto",      meth_sendto},
     {"receive",     meth_receive},
+    {"receivefds",  meth_receivefds},
     {"receivefrom", meth_receivefrom},
+    {"receiveinto", meth_receiveinto},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
     {"setpeername", meth_connect},
@@ -109,7 +116,7 @@ static int meth_send(lua_State *L)
     p_timeout tm = &un->tm;
     size_t count, sent = 0;
     int err;
-    const char *data = luaL_checklstring(L, 2, &count);
+    const char *data = bytes_checklstring(L, 2, &count);
     timeout_markstart(tm);
     err = socket_send(&un->sock, data, count, &sent, tm);
     if (err != IO_DONE) {
@@ -128,7 +135,7 @@ static int meth_sendto(lua_State *L)
 {
     p_unix un = (p_unix) auxiliar_checkclass(L, "unixdgram{unconnected}", 1);
     size_t count, sent = 0;
-    const char *data = luaL_checklstring(L, 2, &count);
+    const char *data = bytes_checklstring(L, 2, &count);
     const char *path = luaL_checkstring(L, 3);
     p_timeout tm = &un->tm;
     int err;
@@ -188,6 +195,28 @@ static int meth_receive(lua_State *L) {
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Receives a datagram into a byte buffer, returning its size
+\*-------------------------------------------------------------------------*/
+static int meth_receiveinto(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkgroup(L, "unixdgram{any}", 1);
+    p_bytes b = bytes_checkwritable(L, 2);
+    size_t got, wanted;
+    size_t offset = bytes_checkrange(L, b, 3, &wanted);
+    int err;
+    p_timeout tm = &un->tm;
+    timeout_markstart(tm);
+    err = socket_recv(&un->sock, b->data + offset, wanted, &got, tm);
+    /* Unlike STREAM, recv() of zero is not closed, but a zero-length packet. */
+    if (err != IO_DONE && err != IO_CLOSED) {
+        lua_pushnil(L);
+        lua_pushstring(L, unixdgram_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, (lua_Number) got);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Receives data and sender from a DGRAM socket
 \*-------------------------------------------------------------------------*/
@@ -224,6 +253,19 @@ static int meth_receivefrom(lua_State *L) {
     return 2;
 }
 
+/*-------------------------------------------------------------------------*\
+* Descriptor passing
+\*-------------------------------------------------------------------------*/
+static int meth_sendfds(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unixdgram{connected}", 1);
+    return unix_meth_sendfds(L, un);
+}
+
+static int meth_receivefds(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkgroup(L, "unixdgram{any}", 1);
+    return unix_meth_receivefds(L, un, 1);
+}
+
 /*-------------------------------------------------------------------------*\
 * Just call option handler
 \*-------------------------------------------------------------------------*/
@@ -0,0 +1,524 @@
+/*=========================================================================*\
+* Shared memory ring sub module
+* LuaSocket toolkit
+\*=========================================================================*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "compat.h"
+
+#include "auxiliar.h"
+#include "unixring.h"
+
+#if defined(__linux__)
+#include <stdint.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#endif
+
+#if defined(__linux__) && defined(MFD_CLOEXEC) && defined(EFD_NONBLOCK)
+
+#define RING_MAGIC 0x4c52494eu
+#define RING_MAXSIZE (1u << 30)
+
+/* indices only ever grow, and are kept on separate cache lines so that
+ * producer and consumer do not fight over them */
+typedef struct t_ringidx_ {
+    volatile uint64_t head;     /* bytes written, owned by the producer */
+    char pad0[56];
+    volatile uint64_t tail;     /* bytes read, owned by the consumer */
+    char pad1[56];
+} t_ringidx;
+
+/* segment layout: this header, then the ring written by side 0, then the
+ * ring written by side 1 */
+struct t_ringshm_ {
+    uint32_t magic;
+    uint32_t size;
+    volatile uint32_t waiting[2];   /* side wants its doorbell rung */
+    volatile uint32_t shut[2];      /* side will not send any more */
+    char pad[40];
+    t_ringidx idx[2];
+};
+
+#define ring_data(ring, side) \
+    ((char *) (ring)->shm + sizeof(t_ringshm) + (size_t) (side)*(ring)->size)
+/* what ring_space and ring_avail return when the indices don't make sense */
+#define RING_BROKEN ((size_t) -1)
+#define ring_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ring_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ring_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int global_open(lua_State *L);
+static int meth_send(lua_State *L);
+static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_shutdown(lua_State *L);
+static int meth_close(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_getfds(lua_State *L);
+static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
+static int meth_getstats(lua_State *L);
+static int meth_setstats(lua_State *L);
+static int meth_settimeout(lua_State *L);
+static int meth_gettimeout(lua_State *L);
+
+static int ring_send(void *ctx, const char *data, size_t count,
+        size_t *sent, p_timeout tm);
+static int ring_recv(void *ctx, char *data, size_t count, size_t *got,
+        p_timeout tm);
+static void ring_destroy(p_ring ring);
+
+/* unixring object methods */
+static luaL_Reg unixring_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
+    {"close",       meth_close},
+    {"dirty",       meth_dirty},
+    {"getfd",       meth_getfd},
+    {"getfds",      meth_getfds},
+    {"getstats",    meth_getstats},
+    {"gettimeout",  meth_gettimeout},
+    {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
+    {"send",        meth_send},
+    {"setstats",    meth_setstats},
+    {"settimeout",  meth_settimeout},
+    {"shutdown",    meth_shutdown},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"ring",        global_create},
+    {"ringopen",    global_open},
+    {NULL,          NULL}
+};
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int unixring_open(lua_State *L)
+{
+    /* create class */
+    auxiliar_newclass(L, "unixring{client}", unixring_methods);
+    auxiliar_add2group(L, "unixring{client}", "unixring{any}");
+    buffer_addreaders(L, "unixring{client}");
+    luaL_setfuncs(L, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Ring primitives
+\*=========================================================================*/
+static void ring_ring(int bell) {
+    uint64_t one = 1;
+    /* can only fail if the counter is about to overflow, which is harmless */
+    if (write(bell, &one, sizeof(one)) < 0) return;
+}
+
+/* rings the other end's doorbell if it is sleeping on us */
+static void ring_notify(p_ring ring) {
+    ring_fence();
+    if (__atomic_load_n(&ring->shm->waiting[!ring->side], __ATOMIC_SEQ_CST))
+        ring_ring(ring->peer);
+}
+
+/* lowers our flag and, if it was up, resets the doorbell the other end
+ * may have rung meanwhile, so that select does not keep reporting it */
+static void ring_clear(p_ring ring) {
+    uint64_t count;
+    if (__atomic_exchange_n(&ring->shm->waiting[ring->side], 0,
+            __ATOMIC_SEQ_CST) && read(ring->sock, &count, sizeof(count)) < 0)
+        return;
+}
+
+/*-------------------------------------------------------------------------*\
+* The indices live in memory the other end can write, so more than a full
+* ring of pending bytes means it is broken or hostile
+\*-------------------------------------------------------------------------*/
+static size_t ring_space(p_ring ring) {
+    t_ringidx *idx = &ring->shm->idx[ring->side];
+    uint64_t used = idx->head - ring_load(&idx->tail);
+    return used <= ring->size? ring->size - (size_t) used: RING_BROKEN;
+}
+
+static size_t ring_avail(p_ring ring) {
+    t_ringidx *idx = &ring->shm->idx[!ring->side];
+    uint64_t avail = ring_load(&idx->head) - idx->tail;
+    return avail <= ring->size? (size_t) avail: RING_BROKEN;
+}
+
+static int ring_peershut(p_ring ring) {
+    return ring_load(&ring->shm->shut[!ring->side]) != 0;
+}
+
+/*-------------------------------------------------------------------------*\
+* Sleeps on our doorbell until the other end changes something. The flag
+* is raised before the condition is checked again, so that a change that
+* happens in between is never missed
+\*-------------------------------------------------------------------------*/
+static int ring_wait(p_ring ring, int forsend, p_timeout tm) {
+    struct pollfd pfd;
+    int ret;
+    /* a select loop may have raised the flag through getfd */
+    if (timeout_iszero(tm)) {
+        ring_clear(ring);
+        return IO_TIMEOUT;
+    }
+    __atomic_store_n(&ring->shm->waiting[ring->side], 1, __ATOMIC_SEQ_CST);
+    ring_fence();
+    if (forsend? ring_space(ring) > 0:
+            ring_avail(ring) > 0 || ring_peershut(ring)) {
+        ring_clear(ring);
+        return IO_DONE;
+    }
+    pfd.fd = ring->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do {
+        int t = (int)(timeout_getretry(tm)*1e3);
+        ret = poll(&pfd, 1, t >= 0? t: -1);
+    } while (ret == -1 && errno == EINTR);
+    ret = ret == -1? errno: (ret == 0? IO_TIMEOUT: IO_DONE);
+    ring_clear(ring);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------*\
+* I/O driver callbacks
+\*-------------------------------------------------------------------------*/
+static int ring_send(void *ctx, const char *data, size_t count,
+        size_t *sent, p_timeout tm) {
+    p_ring ring = (p_ring) ctx;
+    *sent = 0;
+    if (!ring->shm || ring->shm->shut[ring->side]) return IO_CLOSED;
+    if (count == 0) return IO_DONE;
+    for ( ;; ) {
+        size_t space = ring_space(ring);
+        if (space == RING_BROKEN) {
+            ring_destroy(ring);
+            return IO_CLOSED;
+        } else if (space > 0) {
+            t_ringidx *idx = &ring->shm->idx[ring->side];
+            char *base = ring_data(ring, ring->side);
+            uint64_t head = idx->head;
+            size_t off = (size_t) (head & (ring->size - 1));
+            size_t n = count < space? count: space;
+            size_t first = n < ring->size - off? n: ring->size - off;
+            memcpy(base + off, data, first);
+            memcpy(base, data + first, n - first);
+            ring_store(&idx->head, head + n);
+            ring_notify(ring);
+            *sent = n;
+            return IO_DONE;
+        } else {
+            int err = ring_wait(ring, 1, tm);
+            if (err != IO_DONE) return err;
+        }
+    }
+}
+
+static int ring_recv(void *ctx, char *data, size_t count, size_t *got,
+        p_timeout tm) {
+    p_ring ring = (p_ring) ctx;
+    *got = 0;
+    if (!ring->shm) return IO_CLOSED;
+    for ( ;; ) {
+        size_t avail = ring_avail(ring);
+        if (avail == RING_BROKEN) {
+            ring_destroy(ring);
+            return IO_CLOSED;
+        } else if (avail > 0) {
+            t_ringidx *idx = &ring->shm->idx[!ring->side];
+            const char *base = ring_data(ring, !ring->side);
+            uint64_t tail = idx->tail;
+            size_t off = (size_t) (tail & (ring->size - 1));
+            size_t n = count < avail? count: avail;
+            size_t first = n < ring->size - off? n: ring->size - off;
+            memcpy(data, base + off, first);
+            memcpy(data + first, base, n - first);
+            ring_store(&idx->tail, tail + n);
+            ring_notify(ring);
+            ring_clear(ring);
+            *got = n;
+            return IO_DONE;
+        } else if (ring_peershut(ring)) {
+            /* check again, the last bytes may have raced with the flag */
+            if (ring_avail(ring) == 0) return IO_CLOSED;
+        } else {
+            int err = ring_wait(ring, 0, tm);
+            if (err != IO_DONE) return err;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Maps the segment and takes ownership of the descriptors. A non-zero size
+* initializes a fresh segment, otherwise the existing header is checked
+\*-------------------------------------------------------------------------*/
+static const char *ring_attach(p_ring ring, int side, int memfd, int bell,
+        int peer, size_t size) {
+    struct stat st;
+    void *map;
+    ring->memfd = memfd;
+    ring->sock = bell;
+    ring->peer = peer;
+    ring->side = side;
+    if (fstat(memfd, &st) < 0) return socket_strerror(errno);
+    if (st.st_size < (off_t) sizeof(t_ringshm)) return "invalid ring segment";
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+        memfd, 0);
+    if (map == MAP_FAILED) return socket_strerror(errno);
+    ring->shm = (t_ringshm *) map;
+    ring->maplen = (size_t) st.st_size;
+    if (size > 0) {
+        ring->shm->size = (uint32_t) size;
+        ring->shm->magic = RING_MAGIC;
+    }
+    size = ring->shm->size;
+    if (ring->shm->magic != RING_MAGIC || size == 0 || (size & (size-1)) ||
+            ring->maplen != sizeof(t_ringshm) + 2*size)
+        return "invalid ring segment";
+    ring->size = size;
+    return NULL;
+}
+
+static void ring_destroy(p_ring ring) {
+    if (ring->shm) munmap(ring->shm, ring->maplen);
+    ring->shm = NULL;
+    if (ring->memfd >= 0) close(ring->memfd);
+    if (ring->sock >= 0) close(ring->sock);
+    if (ring->peer >= 0) close(ring->peer);
+    ring->memfd = ring->sock = ring->peer = -1;
+}
+
+/* pushes a closed object, so that __gc can clean up after any error */
+static p_ring ring_push(lua_State *L) {
+    p_ring ring = (p_ring) lua_newuserdata(L, sizeof(t_ring));
+    memset(ring, 0, sizeof(t_ring));
+    ring->memfd = ring->sock = ring->peer = -1;
+    auxiliar_setclass(L, "unixring{client}", -1);
+    io_init(&ring->io, ring_send, ring_recv, (p_error) socket_ioerror,
+        ring);
+    timeout_init(&ring->tm, -1, -1);
+    buffer_init(&ring->buf, &ring->io, &ring->tm);
+    return ring;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Just call buffered IO methods
+\*-------------------------------------------------------------------------*/
+static int meth_send(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    return buffer_meth_send(L, &ring->buf);
+}
+
+static int meth_receive(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    return buffer_meth_receive(L, &ring->buf);
+}
+
+static int meth_receiveinto(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    return buffer_meth_receiveinto(L, &ring->buf);
+}
+
+static int meth_getstats(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    return buffer_meth_getstats(L, &ring->buf);
+}
+
+static int meth_setstats(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    return buffer_meth_setstats(L, &ring->buf);
+}
+
+/*-------------------------------------------------------------------------*\
+* Tells the other end that no more data will be sent. It receives what is
+* still in the ring and then gets "closed"
+\*-------------------------------------------------------------------------*/
+static int meth_shutdown(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkclass(L, "unixring{client}", 1);
+    if (!ring->shm) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "closed");
+        return 2;
+    }
+    ring_store(&ring->shm->shut[ring->side], 1);
+    ring_fence();
+    ring_ring(ring->peer);
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Releases the mapping and descriptors. Other holders of the descriptors,
+* such as a forked child, are not affected, so the other end is only told
+* about it by shutdown
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    ring_destroy(ring);
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    /* whoever asks is about to wait on the doorbell, so have it rung. The
+     * next receive lowers the flag again and resets the doorbell */
+    if (ring->shm)
+        __atomic_store_n(&ring->shm->waiting[ring->side], 1, __ATOMIC_SEQ_CST);
+    lua_pushnumber(L, (int) ring->sock);
+    return 1;
+}
+
+static int meth_dirty(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    lua_pushboolean(L, !buffer_isempty(&ring->buf) || (ring->shm &&
+        (ring_avail(ring) > 0 || ring_peershut(ring))));
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_getclassudata(L, "unixring{client}", 1);
+    if (ring) lua_pushlightuserdata(L, &ring->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns what socket.unix.ringopen needs to attach to this end
+\*-------------------------------------------------------------------------*/
+static int meth_getfds(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    if (!ring->shm) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "closed");
+        return 2;
+    }
+    lua_pushnumber(L, ring->side + 1);
+    lua_pushnumber(L, ring->memfd);
+    lua_pushnumber(L, ring->sock);
+    lua_pushnumber(L, ring->peer);
+    return 4;
+}
+
+/*-------------------------------------------------------------------------*\
+* Just call tm methods
+\*-------------------------------------------------------------------------*/
+static int meth_settimeout(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    return timeout_meth_settimeout(L, &ring->tm);
+}
+
+static int meth_gettimeout(lua_State *L) {
+    p_ring ring = (p_ring) auxiliar_checkgroup(L, "unixring{any}", 1);
+    return timeout_meth_gettimeout(L, &ring->tm);
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates both ends of a new ring. Each end holds its own descriptors
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    lua_Number wanted = luaL_optnumber(L, 1, UNIXRING_SIZE);
+    size_t size = 4096;
+    const char *err = NULL;
+    int memfd = -1, bell[2] = {-1, -1};
+    p_ring a, b;
+    luaL_argcheck(L, wanted > 0 && wanted <= RING_MAXSIZE, 1,
+        "invalid ring size");
+    while (size < (size_t) wanted) size <<= 1;
+    a = ring_push(L);
+    b = ring_push(L);
+    memfd = memfd_create("luasocket-ring", MFD_CLOEXEC);
+    if (memfd < 0) err = socket_strerror(errno);
+    else if (ftruncate(memfd, (off_t) (sizeof(t_ringshm) + 2*size)) < 0)
+        err = socket_strerror(errno);
+    else if ((bell[0] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0 ||
+            (bell[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+        err = socket_strerror(errno);
+    if (err) {
+        if (memfd >= 0) close(memfd);
+        if (bell[0] >= 0) close(bell[0]);
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    err = ring_attach(a, 0, memfd, bell[0], bell[1], size);
+    if (!err) err = ring_attach(b, 1, fcntl(memfd, F_DUPFD_CLOEXEC, 0),
+        fcntl(bell[1], F_DUPFD_CLOEXEC, 0), fcntl(bell[0], F_DUPFD_CLOEXEC, 0),
+        0);
+    if (err) {
+        ring_destroy(a);
+        ring_destroy(b);
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Attaches to one end of an existing ring, taking over the descriptors
+\*-------------------------------------------------------------------------*/
+static int global_open(lua_State *L) {
+    int side = (int) luaL_checknumber(L, 1);
+    int memfd = (int) luaL_checknumber(L, 2);
+    int bell = (int) luaL_checknumber(L, 3);
+    int peer = (int) luaL_checknumber(L, 4);
+    const char *err;
+    p_ring ring;
+    luaL_argcheck(L, side == 1 || side == 2, 1, "invalid ring side");
+    ring = ring_push(L);
+    err = ring_attach(ring, side - 1, memfd, bell, peer, 0);
+    if (err) {
+        /* leave the descriptors to the caller */
+        if (ring->shm) munmap(ring->shm, ring->maplen);
+        ring->shm = NULL;
+        ring->memfd = ring->sock = ring->peer = -1;
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    socket_setnonblocking(&ring->sock);
+    return 1;
+}
+
+#else
+
+/*-------------------------------------------------------------------------*\
+* Rings need memfd and eventfd, so there is nothing to add elsewhere
+\*-------------------------------------------------------------------------*/
+int unixring_open(lua_State *L)
+{
+    (void) L;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef UNIXRING_H
+#define UNIXRING_H
+/*=========================================================================*\
+* Shared memory ring object
+* LuaSocket toolkit
+*
+* The unixring.h module provides LuaSocket with a byte stream between two
+* co-located processes that does not go through the kernel's network
+* stack. Each direction is a single-producer/single-consumer ring in a
+* memfd segment mapped by both ends. An eventfd per end serves as its
+* doorbell, and is only rung when that end is waiting for data or space.
+*
+* Objects have the same send/receive/settimeout interface as tcp{client}
+* objects, so code written for TCP runs unchanged over them. The
+* descriptors returned by getfds can be inherited through fork or passed
+* with sendfds and handed to socket.unix.ringopen in the other process.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "buffer.h"
+#include "timeout.h"
+#include "socket.h"
+
+#define UNIXRING_SIZE 65536
+
+typedef struct t_ringshm_ t_ringshm;
+
+typedef struct t_ring_ {
+    t_socket sock;      /* our doorbell, so that select can wait on it */
+    int peer;           /* the other end's doorbell */
+    int memfd;
+    int side;
+    t_ringshm *shm;
+    size_t maplen;
+    size_t size;        /* copied at attach, the peer can rewrite the header */
+    t_io io;
+    t_buffer buf;
+    t_timeout tm;
+} t_ring;
+typedef t_ring *p_ring;
+
+int unixring_open(lua_State *L);
+
+#endif /* UNIXRING_H */
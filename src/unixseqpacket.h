@@ -0,0 +1,21 @@
+#ifndef UNIXSEQPACKET_H
+#define UNIXSEQPACKET_H
+/*=========================================================================*\
+* UNIX SEQPACKET object
+* LuaSocket toolkit
+*
+* The unixseqpacket.h module provides LuaSocket with UNIX SEQPACKET
+* (AF_UNIX, SOCK_SEQPACKET) support. These are connection oriented, like
+* streams, but preserve message boundaries, like datagrams.
+*
+* Three classes are defined: master, client and server, with the same
+* meaning as in unixstream.h. Each send on a client object is received
+* as a whole by a single receive on the other end.
+\*=========================================================================*/
+#include "unix.h"
+
+#define UNIXSEQPACKET_MESSAGESIZE 8192
+
+int unixseqpacket_open(lua_State *L);
+
+#endif /* UNIXSEQPACKET_H */
@@ -24,6 +24,9 @@ static int meth_bind(lua_State *L);
 static int meth_send(lua_State *L);
 static int meth_shutdown(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receiveinto(lua_State *L);
+static int meth_receivefds(lua_State *L);
+static int meth_sendfds(lua_State *L);
 static int meth_accept(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_setoption(lua_State *L);
@@ -31,6 +34,7 @@ static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
 static int meth_setfd(lua_State *L);
 static int meth_dirty(lua_State *L);
+static int meth_buffer(lua_State *L);
 static int meth_getstats(lua_State *L);
 static int meth_setstats(lua_State *L);
 static int meth_getsockname(lua_State *L);
@@ -42,6 +46,7 @@ static const char *unixstream_trybind(p_unix un, const char *path);
 static luaL_Reg unixstream_methods[] = {
     {"__gc",        meth_close},
     {"__tostring",  auxiliar_tostring},
+    {"__buffer",    meth_buffer},
     {"accept",      meth_accept},
     {"bind",        meth_bind},
     {"close",       meth_close},
@@ -52,7 +57,10 @@ static luaL_Reg unixstream_methods[] = {
     {"setstats",    meth_setstats},
     {"listen",      meth_listen},
     {"receive",     meth_receive},
+    {"receiveinto", meth_receiveinto},
+    {"receivefds",  meth_receivefds},
     {"send",        meth_send},
+    {"sendfds",     meth_sendfds},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
     {"setpeername", meth_connect},
@@ -91,6 +99,7 @@ int unixstream_open(lua_State *L)
     auxiliar_add2group(L, "unixstream{master}", "unixstream{any}");
     auxiliar_add2group(L, "unixstream{client}", "unixstream{any}");
     auxiliar_add2group(L, "unixstream{server}", "unixstream{any}");
+    buffer_addreaders(L, "unixstream{client}");
 
     luaL_setfuncs(L, func, 0);
     return 0;
@@ -112,6 +121,11 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &un->buf);
 }
 
+static int meth_receiveinto(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unixstream{client}", 1);
+    return buffer_meth_receiveinto(L, &un->buf);
+}
+
 static int meth_getstats(lua_State *L) {
     p_unix un = (p_unix) auxiliar_checkclass(L, "unixstream{client}", 1);
     return buffer_meth_getstats(L, &un->buf);
@@ -122,6 +136,19 @@ static int meth_setstats(lua_State *L) {
     return buffer_meth_setstats(L, &un->buf);
 }
 
+/*-------------------------------------------------------------------------*\
+* Descriptor passing
+\*-------------------------------------------------------------------------*/
+static int meth_sendfds(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unixstream{client}", 1);
+    return unix_meth_sendfds(L, un);
+}
+
+static int meth_receivefds(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unixstream{client}", 1);
+    return unix_meth_receivefds(L, un, 0);
+}
+
 /*-------------------------------------------------------------------------*\
 * Just call option handler
 \*-------------------------------------------------------------------------*/
@@ -152,6 +179,16 @@ static int meth_dirty(lua_State *L) {
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Hands the buffer of a connected object to socket.pump
+\*-------------------------------------------------------------------------*/
+static int meth_buffer(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_getclassudata(L, "unixstream{client}", 1);
+    if (un) lua_pushlightuserdata(L, &un->buf);
+    else lua_pushnil(L);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Waits for and returns a client object attempting connection to the
 * server object
@@ -6,12 +6,20 @@
 * The penalty of calling select to avoid busy-wait is only paid when
 * the I/O call fail in the first place.
 \*=========================================================================*/
+/* recvmmsg and sendmmsg are GNU extensions */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <string.h>
 #include <signal.h>
 
 #include "socket.h"
 #include "pierror.h"
 
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
+
 /*-------------------------------------------------------------------------*\
 * Wait for readable/writable/connected socket with timeout
 \*-------------------------------------------------------------------------*/
@@ -294,6 +302,317 @@ int socket_recvfrom(p_socket ps, char *data, size_t count, size_t *got,
     return IO_UNKNOWN;
 }
 
+/*-------------------------------------------------------------------------*\
+* Batched datagram I/O with timeout
+* Receiving waits for the first datagram only, and then returns whatever
+* else is already queued. Sending goes on until all datagrams are out.
+\*-------------------------------------------------------------------------*/
+#ifdef SOCKET_MMSG
+static size_t setup_mmsg(struct mmsghdr *msgs, struct iovec *iovs,
+        p_dgram dgrams, size_t count) {
+    size_t i;
+    if (count > SOCKET_BATCHSIZE) count = SOCKET_BATCHSIZE;
+    memset(msgs, 0, count*sizeof(*msgs));
+    for (i = 0; i < count; i++) {
+        iovs[i].iov_base = dgrams[i].data;
+        iovs[i].iov_len = dgrams[i].count;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = dgrams[i].addr;
+        msgs[i].msg_hdr.msg_namelen = dgrams[i].addr? dgrams[i].addr_len: 0;
+    }
+    return count;
+}
+
+int socket_sendmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *sent, p_timeout tm)
+{
+    struct mmsghdr msgs[SOCKET_BATCHSIZE];
+    struct iovec iovs[SOCKET_BATCHSIZE];
+    int err;
+    *sent = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    while (*sent < count) {
+        p_dgram d = dgrams + *sent;
+        size_t n = setup_mmsg(msgs, iovs, d, count - *sent);
+        int put = sendmmsg(*ps, msgs, (unsigned int) n, 0);
+        if (put > 0) {
+            int i;
+            for (i = 0; i < put; i++) d[i].count = msgs[i].msg_len;
+            *sent += put;
+            continue;
+        }
+        err = errno;
+        if (err == EPIPE) return IO_CLOSED;
+        if (err == EPROTOTYPE) continue;
+        if (err == EINTR) continue;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_W, tm)) != IO_DONE) return err;
+    }
+    return IO_DONE;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *got, p_timeout tm)
+{
+    struct mmsghdr msgs[SOCKET_BATCHSIZE];
+    struct iovec iovs[SOCKET_BATCHSIZE];
+    int err;
+    *got = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    while (*got < count) {
+        p_dgram d = dgrams + *got;
+        size_t n = setup_mmsg(msgs, iovs, d, count - *got);
+        int taken = recvmmsg(*ps, msgs, (unsigned int) n, MSG_DONTWAIT, NULL);
+        if (taken > 0) {
+            int i;
+            for (i = 0; i < taken; i++) {
+                d[i].count = msgs[i].msg_len;
+                d[i].addr_len = msgs[i].msg_hdr.msg_namelen;
+            }
+            *got += taken;
+            /* queue drained */
+            if ((size_t) taken < n) break;
+            continue;
+        }
+        err = errno;
+        if (err == EINTR) continue;
+        /* report what we have, the error will show up again next time */
+        if (*got > 0) break;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_R, tm)) != IO_DONE) return err;
+    }
+    return IO_DONE;
+}
+#else
+int socket_sendmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *sent, p_timeout tm)
+{
+    int err = IO_DONE;
+    *sent = 0;
+    while (*sent < count) {
+        p_dgram d = dgrams + *sent;
+        size_t put;
+        if (d->addr) err = socket_sendto(ps, d->data, d->count, &put,
+            d->addr, d->addr_len, tm);
+        else err = socket_send(ps, d->data, d->count, &put, tm);
+        if (err != IO_DONE) break;
+        d->count = put;
+        (*sent)++;
+    }
+    return err;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *got, p_timeout tm)
+{
+    int err = IO_DONE;
+    t_timeout zero;
+    timeout_init(&zero, 0.0, -1);
+    *got = 0;
+    while (*got < count) {
+        p_dgram d = dgrams + *got;
+        size_t taken;
+        err = socket_recvfrom(ps, d->data, d->count, &taken, d->addr,
+            &d->addr_len, *got > 0? &zero: tm);
+        /* a zero-length datagram is reported as closed */
+        if (err != IO_DONE && err != IO_CLOSED) break;
+        d->count = taken;
+        (*got)++;
+    }
+    return *got > 0? IO_DONE: err;
+}
+#endif
+
+/*-------------------------------------------------------------------------*\
+* Receive or recvfrom with timeout, also collecting what the kernel reports
+* in control messages: the UDP GRO segment size and the arrival timestamp
+\*-------------------------------------------------------------------------*/
+#ifdef __linux__
+static void socket_getinfo(struct msghdr *msg, p_rcvinfo info) {
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef UDP_GRO
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            info->segsize = (size_t) size;
+        }
+#endif
+        if (cmsg->cmsg_level != SOL_SOCKET) continue;
+#ifdef SCM_TIMESTAMPNS
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            info->stamp = ts.tv_sec + ts.tv_nsec/1.0e9;
+        }
+#endif
+#ifdef SCM_TIMESTAMPING
+        /* software stamp first, then the raw hardware one, if present */
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct timespec ts[3];
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+            if (ts[2].tv_sec || ts[2].tv_nsec)
+                info->stamp = ts[2].tv_sec + ts[2].tv_nsec/1.0e9;
+            else if (ts[0].tv_sec || ts[0].tv_nsec)
+                info->stamp = ts[0].tv_sec + ts[0].tv_nsec/1.0e9;
+        }
+#endif
+    }
+}
+
+int socket_recvinfo(p_socket ps, char *data, size_t count, size_t *got,
+        SA *addr, socklen_t *addr_len, p_rcvinfo info, p_timeout tm) {
+    int err;
+    *got = 0;
+    info->segsize = 0;
+    info->stamp = -1;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    for ( ;; ) {
+        char control[CMSG_SPACE(sizeof(int)) +
+            CMSG_SPACE(3*sizeof(struct timespec))];
+        struct iovec iov;
+        struct msghdr msg;
+        long taken;
+        iov.iov_base = data;
+        iov.iov_len = count;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = addr;
+        msg.msg_namelen = addr? *addr_len: 0;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        taken = (long) recvmsg(*ps, &msg, 0);
+        if (taken > 0) {
+            if (addr) *addr_len = msg.msg_namelen;
+            socket_getinfo(&msg, info);
+            *got = taken;
+            return IO_DONE;
+        }
+        err = errno;
+        if (taken == 0) {
+            if (addr) *addr_len = msg.msg_namelen;
+            return IO_CLOSED;
+        }
+        if (err == EINTR) continue;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_R, tm)) != IO_DONE) return err;
+    }
+    return IO_UNKNOWN;
+}
+#else
+int socket_recvinfo(p_socket ps, char *data, size_t count, size_t *got,
+        SA *addr, socklen_t *addr_len, p_rcvinfo info, p_timeout tm) {
+    info->segsize = 0;
+    info->stamp = -1;
+    if (addr) return socket_recvfrom(ps, data, count, got, addr, addr_len, tm);
+    else return socket_recv(ps, data, count, got, tm);
+}
+#endif
+
+
+/*-------------------------------------------------------------------------*\
+* Send with timeout, passing descriptors along with the first byte
+\*-------------------------------------------------------------------------*/
+typedef union t_fdcontrol_ {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(SOCKET_MAXFDS*sizeof(int))];
+} t_fdcontrol;
+
+int socket_sendfds(p_socket ps, const char *data, size_t count,
+        size_t *sent, const int *fds, int nfds, p_timeout tm)
+{
+    int err;
+    t_fdcontrol control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    size_t fdsize = nfds*sizeof(int);
+    *sent = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    if (nfds < 0 || nfds > SOCKET_MAXFDS) return EINVAL;
+    iov.iov_base = (char *) data;
+    iov.iov_len = count;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(fdsize);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fdsize);
+        memcpy(CMSG_DATA(cmsg), fds, fdsize);
+    }
+    for ( ;; ) {
+        long put = (long) sendmsg(*ps, &msg, 0);
+        if (put >= 0) {
+            *sent = put;
+            return IO_DONE;
+        }
+        err = errno;
+        if (err == EPIPE) return IO_CLOSED;
+        if (err == EPROTOTYPE) continue;
+        if (err == EINTR) continue;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_W, tm)) != IO_DONE) return err;
+    }
+    return IO_UNKNOWN;
+}
+
+/*-------------------------------------------------------------------------*\
+* Receive with timeout, collecting up to SOCKET_MAXFDS passed descriptors
+* into fds. A zero-length read that brings no descriptors is reported
+* as closed
+\*-------------------------------------------------------------------------*/
+int socket_recvfds(p_socket ps, char *data, size_t count, size_t *got,
+        int *fds, int *nfds, p_timeout tm)
+{
+    int err, flags = 0;
+    t_fdcontrol control;
+#ifdef MSG_CMSG_CLOEXEC
+    flags = MSG_CMSG_CLOEXEC;
+#endif
+    *got = 0;
+    *nfds = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    for ( ;; ) {
+        struct iovec iov;
+        struct msghdr msg;
+        long taken;
+        iov.iov_base = data;
+        iov.iov_len = count;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        taken = (long) recvmsg(*ps, &msg, flags);
+        if (taken >= 0) {
+            struct cmsghdr *cmsg;
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                        cmsg->cmsg_type == SCM_RIGHTS) {
+                    int n = (int) ((cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int));
+                    if (n > SOCKET_MAXFDS - *nfds) n = SOCKET_MAXFDS - *nfds;
+                    memcpy(fds + *nfds, CMSG_DATA(cmsg), n*sizeof(int));
+                    *nfds += n;
+                }
+            }
+            *got = taken;
+            return taken > 0 || *nfds > 0? IO_DONE: IO_CLOSED;
+        }
+        err = errno;
+        if (err == EINTR) continue;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_R, tm)) != IO_DONE) return err;
+    }
+    return IO_UNKNOWN;
+}
 
 /*-------------------------------------------------------------------------*\
 * Write with timeout
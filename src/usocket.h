@@ -50,6 +50,11 @@
 #endif /* IPV6_LEAVE_GROUP */
 #endif /* !IPV6_DROP_MEMBERSHIP */
 
+/* Linux moves many datagrams per system call */
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define SOCKET_MMSG
+#endif
+
 typedef int t_socket;
 typedef t_socket *p_socket;
 typedef struct sockaddr_storage t_sockaddr_storage;
@@ -294,6 +294,60 @@ int socket_recvfrom(p_socket ps, char *data, size_t count, size_t *got,
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Batched datagram I/O with timeout
+* WinSock has no batched calls, so we loop over the single ones
+\*-------------------------------------------------------------------------*/
+int socket_sendmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *sent, p_timeout tm)
+{
+    int err = IO_DONE;
+    *sent = 0;
+    while (*sent < count) {
+        p_dgram d = dgrams + *sent;
+        size_t put;
+        if (d->addr) err = socket_sendto(ps, d->data, d->count, &put,
+            d->addr, d->addr_len, tm);
+        else err = socket_send(ps, d->data, d->count, &put, tm);
+        if (err != IO_DONE) break;
+        d->count = put;
+        (*sent)++;
+    }
+    return err;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dgrams, size_t count,
+        size_t *got, p_timeout tm)
+{
+    int err = IO_DONE;
+    t_timeout zero;
+    timeout_init(&zero, 0.0, -1);
+    *got = 0;
+    while (*got < count) {
+        p_dgram d = dgrams + *got;
+        size_t taken;
+        err = socket_recvfrom(ps, d->data, d->count, &taken, d->addr,
+            &d->addr_len, *got > 0? &zero: tm);
+        /* a zero-length datagram is reported as closed */
+        if (err != IO_DONE && err != IO_CLOSED) break;
+        d->count = taken;
+        (*got)++;
+    }
+    return *got > 0? IO_DONE: err;
+}
+
+/*-------------------------------------------------------------------------*\
+* Receive or recvfrom with timeout, collecting control message information
+* There is no segmentation offload or arrival timestamp to report here
+\*-------------------------------------------------------------------------*/
+int socket_recvinfo(p_socket ps, char *data, size_t count, size_t *got,
+        SA *addr, socklen_t *addr_len, p_rcvinfo info, p_timeout tm) {
+    info->segsize = 0;
+    info->stamp = -1;
+    if (addr) return socket_recvfrom(ps, data, count, got, addr, addr_len, tm);
+    else return socket_recv(ps, data, count, got, tm);
+}
+
 /*-------------------------------------------------------------------------*\
 * Put socket into blocking mode
 \*-------------------------------------------------------------------------*/
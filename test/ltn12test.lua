@@ -297,3 +297,60 @@ assert(filter4(nil, 1), "filter4 not empty")
 assert(filter5(nil, 1), "filter5 not empty")
 print("ok")
 
+
+--------------------------------
+io.write("testing source.file (growing chunks): ")
+local name = os.tmpname()
+local f = assert(io.open(name, "wb"))
+f:write(string.rep("x", 200000))
+f:close()
+source = ltn12.source.file(io.open(name, "rb"))
+local sizes = {}
+sink = function(chunk)
+    if chunk then table.insert(sizes, string.len(chunk)) end
+    return 1
+end
+assert(ltn12.pump.all(source, sink))
+os.remove(name)
+assert(sizes[1] == ltn12.BLOCKSIZE and sizes[2] == 2*ltn12.BLOCKSIZE)
+local total = 0
+for i, size in ipairs(sizes) do
+    assert(size <= ltn12.MAXBLOCKSIZE)
+    total = total + size
+end
+assert(total == 200000 and sizes[#sizes-1] == ltn12.MAXBLOCKSIZE)
+print("ok")
+
+--------------------------------
+io.write("testing socket sources (adaptive chunks): ")
+local socket = require("socket")
+-- a fake clock makes every receive take step seconds
+local gettime, clock, step = socket.gettime, 0, 0.001
+socket.gettime = function() clock = clock + step; return clock end
+local a, b = assert(socket.memchannel(1024*1024))
+assert(a:send(string.rep("x", 8*socket.MAXBLOCKSIZE)))
+source = socket.source("until-closed", b)
+sizes = {}
+-- bulk data at a steady rate: chunks double up to the maximum
+repeat
+    local chunk = assert(source())
+    table.insert(sizes, string.len(chunk))
+until sizes[#sizes] == socket.MAXBLOCKSIZE
+assert(sizes[1] == socket.BLOCKSIZE)
+for i = 2, #sizes do assert(sizes[i] == 2*sizes[i-1]) end
+-- reads that get much slower halve it again
+step = 0.01
+assert(string.len(source()) == socket.MAXBLOCKSIZE)
+assert(string.len(source()) == socket.MAXBLOCKSIZE/2)
+-- the same goes for a source that reads a given length, which never
+-- asks for more than is left
+step = 0.001
+source = socket.source("by-length", b, 3*socket.BLOCKSIZE + 1)
+assert(string.len(source()) == socket.BLOCKSIZE)
+assert(string.len(source()) == 2*socket.BLOCKSIZE)
+assert(string.len(source()) == 1)
+assert(source() == nil)
+socket.gettime = gettime
+a:close()
+b:close()
+print("ok")
@@ -203,6 +203,85 @@ io.write("testing b64 chained encode: ")
     compare(b64test, db64test)
 end
 
+local function native_chain_test()
+io.write("testing native chain: ")
+    local nb64test = b64test .. "n"
+    local chain = mime.chain("b64", {"wrp", 27}, "b64", {"wrp", 30},
+        "b64", {"wrp", 59}, "b64", "wrp")
+    transform(b64test, nb64test, chain)
+    compare(eb64test, nb64test)
+io.write("testing native chain decode: ")
+    chain = mime.chain("unb64", "unb64", "unb64", "unb64")
+    transform(nb64test, db64test, chain)
+    compare(b64test, db64test)
+    os.remove(nb64test)
+end
+
+-- runs data through filter, in chunks of the given size
+local function pumped(filter, data, size)
+    local i = 1
+    local source = function()
+        if i > string.len(data) then return nil end
+        local chunk = string.sub(data, i, i+size-1)
+        i = i + size
+        return chunk
+    end
+    local t = {}
+    ltn12.pump.all(ltn12.source.chain(source, filter), ltn12.sink.table(t))
+    return table.concat(t)
+end
+
+local function native_chain_text_test()
+io.write("testing native text chains: ")
+    local bytes = {}
+    for i = 0, 255 do bytes[#bytes+1] = string.char(i) end
+    local data = string.gsub(mao, "\n", "\r\n") .. "\r\n.\r\n..\r\n" ..
+        "x=41=0D=0A=\r\ny =3d\t\r\n.end\n\r\r" .. table.concat(bytes)
+    local function qpwrp(length)
+        return ltn12.filter.cycle(mime.qpwrp, length, length)
+    end
+    local chains = {
+        { function() return mime.chain("qp", "qpwrp") end,
+          function() return ltn12.filter.chain(
+              mime.encode("quoted-printable"), qpwrp(76)) end },
+        { function() return mime.chain({"qp", "=0D=0A"}, {"qpwrp", 40},
+              "unqp") end,
+          function() return ltn12.filter.chain(
+              mime.encode("quoted-printable", "binary"), qpwrp(40),
+              mime.decode("quoted-printable")) end },
+        { function() return mime.chain({"eol", "\n"}, "dot") end,
+          function() return ltn12.filter.chain(mime.normalize("\n"),
+              mime.stuff()) end },
+        { function() return mime.chain("unqp", {"eol", "<br>"}, "dot",
+              "qp", {"qpwrp", 20}) end,
+          function() return ltn12.filter.chain(
+              mime.decode("quoted-printable"), mime.normalize("<br>"),
+              mime.stuff(), mime.encode("quoted-printable"),
+              qpwrp(20)) end },
+    }
+    -- small chunks split CRLF pairs and =XX escapes
+    for i, c in ipairs(chains) do
+        for _, size in ipairs{1, 2, 3, 5, 64, 4096} do
+            local native = pumped(c[1](), data, size)
+            if native ~= pumped(c[2](), data, size) then
+                fail("chain " .. i .. " differs with chunks of " .. size)
+            end
+        end
+    end
+    -- binary quoted-printable goes back to the input
+    if pumped(chains[2][1](), data, 3) ~= data then
+        fail("binary quoted-printable round trip failed")
+    end
+    -- once ended, only nils are accepted
+    local chain = mime.chain("qp")
+    chain("a=b")
+    chain(nil)
+    if pcall(chain, "more") then fail("chunk accepted after end") end
+    if chain(nil) ~= nil then fail("output after end") end
+    if pcall(chain, "more") then fail("chunk accepted after end") end
+    print("ok")
+end
+
 local function identity_test()
 io.write("testing identity: ")
     local chain = named(ltn12.filter.chain(
@@ -282,6 +361,8 @@ identity_test()
 encode_b64test()
 decode_b64test()
 compare_b64test()
+native_chain_test()
+native_chain_text_test()
 cleanup_b64test()
 padding_b64test()
 test_b64lowlevel()